@@ -9,6 +9,7 @@
 #include <Eigen/Dense>
 #include <Eigen/Geometry>
 #include "target.h" // has FiberType
+#include "utils.h"
 
 // extern const double alphaLen;
 // extern const double betaLen;
@@ -28,6 +29,7 @@ public:
     std::string holeID;
     int nDecollide = 0;
     int lastStepNum = 0;
+    int clearUntilStep = -1; // collision checks may be skipped through this step
     long assignedTargetID = -1; // -1 indicates no assigned target
     // bool atTarget = false;
     bool hasDestinationAlphaBeta = false;
@@ -37,6 +39,8 @@ public:
     double xPos, yPos, alpha, beta, destinationAlpha, destinationBeta; //, targetX, targetY;
     double angStep, minReach, maxReach;
     double collisionBuffer = 0;
+    double clearance = 0; // mm of free travel before a collision is possible
+    double fiberReach = 0; // wok xy distance from the base any fiber can reach, set by initGrid
     std::vector<double> alphaVel;
     std::vector<double> betaVel;
     std::vector<double> smoothAlphaVel;
@@ -85,9 +89,20 @@ public:
     std::vector<vec2> interpSimplifiedAlphaPath, interpSimplifiedBetaPath; // dense
     std::vector<vec2> interpAlphaX, interpAlphaY, interpBetaX, interpBetaY; // smoothed
     std::vector<vec2> interpCollisions; // boolean points for collided or not
+    bool streamPath = false; // addPathPoint feeds the simplified paths, no dense paths kept
+    StreamSimplifier alphaStream, betaStream; // open segment state while streaming
+    std::vector<vec2> retimedAlphaPath, retimedBetaPath; // (seconds, deg) from RobotGrid::retimePaths
     std::vector<int> robotNeighbors; // robot IDs in RobotGrid.robotDict may potentially collide
     std::vector<int> fiducialNeighbors; // fiducial IDs in RobotGrid.fiducialDict may potentially collide
     std::vector<long> validTargetIDs; // target IDs in RobotGrid.targetDict that I can reach
+    // cost to go field over the alpha/beta lattice, built by RobotGrid::buildCostField
+    bool useCostField = false; // score with the field (only valid for current destination)
+    double costFieldStep = 0; // lattice spacing (deg), node i is at i*costFieldStep
+    int costFieldNAlpha = 0;
+    int costFieldNBeta = 0;
+    double costFieldAlpha, costFieldBeta; // destination the field was built for
+    std::vector<float> costField; // steps to destination, alpha major
+    std::vector<bool> costFieldBlocked; // lattice nodes colliding with a fiducial
     Robot (int id, std::string holeID, vec3 basePos, vec3 iHat, vec3 jHat,
             vec3 kHat, vec3 dxyz, double alphaLen, double alphaOffDeg,
             double betaOffDeg, double elementHeight, double scaleFac, vec2 metBetaXY,
@@ -96,10 +111,16 @@ public:
             bool hasApogee = true
     );
     void setAlphaBeta (double alpha, double beta);
+    std::array<vec3, 2> collisionSegAt(double alpha, double beta) const; // no state change
+    vec3 fiberWokXYZAt(double alpha, double beta, FiberType fiberType) const; // no state change
     void setDestinationAlphaBeta(double alpha, double beta);
+    void addPathPoint(int stepNum);
+    void startStream(double epsilon); // simplify path points as they are added
+    void finishStream(); // keep the final path point
     void setFiberToWokXYZ (vec3 wokXYZ, FiberType fiberType); // xy in focal plane coord sys
     // void setAlphaBetaRand();
     double score(); // metric for how close to target I am
+    double costToGo(); // steps to destination from cost field
     // double betaWeightedScore(); // metric for how close to target I am
     // double betaScore();
     // double alphaScore();
@@ -112,14 +133,17 @@ public:
     vec2 randomXYUniform();
     // void stepTowardFold(int stepNum);
     void simplifyPath(double epsilon);
+    void simplifyPathWithin(double epsilon, const std::vector<double> & maxDeviation); // stay near the rough path
+    void interpolateSimplified(); // dense paths from the simplified ones
     void smoothVelocity(int points);
     void setCollisionBuffer(double newBuffer);
-    vec2 alphaBetaFromWokXYZ(vec3 wokXYZ, FiberType fiberType);
+    vec2 alphaBetaFromWokXYZ(vec3 wokXYZ, FiberType fiberType) const;
     vec2 convFiberXY(double x, double y, FiberType fromFiberType, FiberType toFiberType);
     // bool isValidTarget(double x, double y, int fiberID);
     void assignTarget(long targetID);
     void clearAssignment();
     double getMaxReach();
+    double maxFiberReach() const; // wok xy radius around the base holding every fiber position
     bool isAssigned();
     // double maxDisplacement();
     // bool canSwapTarget(std::shared_ptr<Robot> robot);
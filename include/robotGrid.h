@@ -1,4 +1,7 @@
 #pragma once
+#include <cstdint>
+#include <random>
+#include <tuple>
 #include "robot.h"
 #include "target.h"
 #include "fiducial.h"
@@ -17,6 +20,13 @@
 
 enum AlgType {Greedy, MDP, Fold}; // order is important
 
+// N x 3 (or N x 2) arrays stored row major, like numpy arrays,
+// so pybind can pass them without reordering
+typedef Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor> RowMatrixX3d;
+typedef Eigen::Matrix<double, Eigen::Dynamic, 2, Eigen::RowMajor> RowMatrixX2d;
+// numpy int64 IDs, long is only 32 bits on some platforms
+typedef Eigen::Matrix<int64_t, Eigen::Dynamic, 1> VectorXi64;
+
 class RobotGrid {
 public:
     AlgType algType;
@@ -30,14 +40,40 @@ public:
     int nSteps;
     int seed;
     int maxPathSteps;
+    int maxStepMultiplier = 1; // most steps a clear robot may take per greedy sweep
+    int nSweeps; // sweeps over the grid taken by last path gen
+    long nStepCalls = 0; // robot moves chosen (stepGreedy/stepGreedyMulti calls) by last pathGenGreedy
+    long nMultiSteps = 0; // of those, moves covering several steps at once
+    bool useCostFields = false; // score moves with per robot cost to go fields
+    double costFieldStep; // lattice spacing for cost fields (deg)
+    int maxClusterAttempts = 20; // planning orders solveCluster tries
+    long maxClusterExpansions = 50000; // A* expansions solveCluster may spend over all its attempts
+    long nClusterExpansions = 0; // A* expansions spent by last solveCluster
+    bool streamSimplify = false; // simplify during pathGenGreedy/MDP, no dense paths kept
+    bool clearanceSimplify = false; // keep simplified paths within the rough paths' clearance
     int smoothCollisions;
+    std::vector<double> stepTimes; // seconds at each step, from retimePaths
     bool initialized = false;
     double maxDisplacement;
+    bool skipClearChecks = true; // skip collision checks for robots with large clearance
+    long nSkippedChecks = 0; // collision checks skipped during last path gen
     std::map<int, std::shared_ptr<Robot>> robotDict;
     std::map<int, std::shared_ptr<Fiducial>> fiducialDict;
     // std::vector<std::array<double, 2>> fiducialList;
     std::map<long, std::shared_ptr<Target>> targetDict;
+    double reachCellSize = 0; // side of the reachCells squares (mm)
+    std::map<std::pair<int, int>, std::vector<int>> reachCells; // robot IDs whose fiber reach touches each square
     std::vector<vec2> perturbArray; // alpha/beta perturbations
+    // target conflict graph from buildConflictGraph, nodes are valid
+    // (robot, target) pairs, node ii's conflicts (sorted) are
+    // conflictNodes[conflictStart[ii]:conflictStart[ii+1]]
+    std::vector<int> nodeRobotIDs;
+    std::vector<long> nodeTargetIDs;
+    std::vector<int> conflictStart;
+    std::vector<int> conflictNodes;
+    std::map<int, int> robotFirstNode; // robot ID -> its first node, nodes follow validTargetIDs
+    long targetVersion = 0; // bumped whenever targets are added or removed, or the collision buffer changes
+    long conflictGraphVersion = -1; // targetVersion the conflict graph was built for
     RobotGrid (double angStep = 1, double collisionBuffer = 2, double epsilon = 2, int seed = 0);
     void addRobot(
         int robotID, std::string holeID, vec3 basePos, vec3 iHat, vec3 jHat,
@@ -47,20 +83,68 @@ public:
         std::array<vec2, 2> collisionSegBetaXY, bool hasApogee = true
     );
     void addTarget(long targetID, vec3 xyzWok, FiberType fiberType, double priority = 0);
+    std::vector<int> reachCandidates(vec3 xyzWok); // robot IDs that may reach a wok position
+    void addTargets(
+        const Eigen::Ref<const VectorXi64> & targetIDs,
+        const Eigen::Ref<const RowMatrixX3d> & xyzWok,
+        const Eigen::Ref<const Eigen::VectorXi> & fiberTypes,
+        const Eigen::Ref<const Eigen::VectorXd> & priorities, int nThreads = 0
+    ); // many targets at once, reachability checked in parallel
+    std::tuple<RowMatrixX3d, RowMatrixX3d, RowMatrixX3d, RowMatrixX3d, RowMatrixX3d> forwardKinematics(
+        const Eigen::Ref<const Eigen::VectorXi> & robotIDs,
+        const Eigen::Ref<const Eigen::VectorXd> & alphas,
+        const Eigen::Ref<const Eigen::VectorXd> & betas, int nThreads = 0
+    ) const; // met, apogee, boss fiber and collision segment end wok xyz, robots untouched
+    RowMatrixX2d inverseKinematics(
+        const Eigen::Ref<const Eigen::VectorXi> & robotIDs,
+        const Eigen::Ref<const RowMatrixX3d> & xyzWok,
+        const Eigen::Ref<const Eigen::VectorXi> & fiberTypes, int nThreads = 0
+    ) const; // alpha/beta putting each fiber on xyzWok, nan if out of reach
+    void removeTargets(std::vector<long> targetIDs); // only the robots that could reach them are touched
+    void updateTargets(
+        std::vector<long> removeTargetIDs,
+        const Eigen::Ref<const VectorXi64> & targetIDs,
+        const Eigen::Ref<const RowMatrixX3d> & xyzWok,
+        const Eigen::Ref<const Eigen::VectorXi> & fiberTypes,
+        const Eigen::Ref<const Eigen::VectorXd> & priorities, int nThreads = 0
+    ); // apply a field diff, assignments to kept targets stay
     void addFiducial(int fiducialID, vec3 xyzWok, double collisionBuffer = 1.5);
     void initGrid();
+    void buildReachCells(); // reachCells from each robot's fiberReach
     void decollideGrid();
     int getNCollisions();
     std::vector<int> deadlockedRobots(); // robots not on target
+    std::vector<std::vector<int>> deadlockedClusters(); // deadlocked robots + neighbors
+    bool solveCluster(std::vector<int> robotIDs, int maxExpansions = 100000);
+    int resolveDeadlocks(int maxClusterSize = 30, int maxExpansions = 100000);
     void clearPaths();
+    void buildCostField(int robotID);
     // void pathGen(); // step towards fold, initial solution
     void pathGenGreedy(); // stepRotational with encroachment
+    void pathGenTiled(double tileSize, int nThreads = 0); // greedy, tiles of one color stepped in parallel
     void pathGenMDP(double greed, double phobia); // Markov Decision Process
-    void simplifyPaths();
-    void smoothPaths(int points);
-    void verifySmoothed();
-    // void optimizeTargets();
+    int shortcutPaths(int nIterations = 1000, int nThreads = 0); // straighten rough paths where clear
+    void finishStreams(); // end streamed simplification after path gen
+    void simplifyPaths(int nThreads = 0);
+    std::vector<std::vector<double>> roughClearances(int nThreads = 0); // by robot, then step
+    void smoothPaths(int points, int nThreads = 0);
+    void verifySmoothed(int nThreads = 0);
+    std::tuple<std::vector<int>, std::vector<std::array<int, 3>>, std::vector<std::array<int, 3>>, int> verifyTrajectories(
+        std::vector<int> robotIDs, const Eigen::MatrixXd & alphas,
+        const Eigen::MatrixXd & betas, int nThreads = 0
+    ); // collisions along alpha/beta trajectories, robots untouched
+    std::tuple<int, double> tuneSimplification(
+        std::vector<int> smoothPoints, double minEpsilon, double maxEpsilon,
+        double tolerance = 0.05, int nThreads = 0
+    ); // sparsest collision free smoothing window and epsilon
+    double retimePaths(
+        double maxAlphaSpeed, double maxBetaSpeed,
+        double maxAlphaAccel, double maxBetaAccel
+    ); // shortest move under speed/accel limits, returns seconds
+    double optimizeTargets(bool usePriority = true, int maxPasses = 20, int nThreads = 0); // returns total assigned
     void setCollisionBuffer(double newBuffer);
+    std::string snapshot() const; // versioned binary copy of the whole grid
+    void restore(const char * data, size_t size); // replace everything with a snapshot's grid
     // void setTargetList(Eigen::MatrixXd myTargetList); //std::vector<std::array<double, 5>> myTargetList);
     // void addTargetList(Eigen::MatrixXd myTargetList);
     std::shared_ptr<Robot> getRobot(int robotID);
@@ -69,22 +153,30 @@ public:
     std::vector<long> assignedTargets(); // returns targetIDs
     bool throwAway(int robotID);
     bool replaceNearFold(int robotID);
-    // void pairwiseSwap();
+    int pairwiseSwap(bool usePriority = true, int maxPasses = 20); // returns number of swaps
     // void swapTargets(int r1ind, int r2ind);
-    // void greedyAssign();
+    void greedyAssign(bool usePriority = true);
     void clearTargetDict();
     void assignRobot2Target(int robotID, long targID);
     void unassignTarget(long targID);
     void unassignRobot(int robotID);
-    bool isValidAssignment(int robotID, long targID);
+    bool isValidAssignment(int robotID, long targID) const;
+    bool canReach(int robotID, vec3 xyzWok, FiberType fiberType) const; // robot left untouched
     std::vector<int> unassignedRobots();
     // bool canSwapTarget(std::shared_ptr<Robot> r1, std::shared_ptr<Robot> r2);
     bool isCollided(int robotID);
-    std::tuple<bool, bool, std::vector<int>> isCollidedWithAssigned(int robotID);
-    std::tuple<bool, bool, std::vector<int>> wouldCollideWithAssigned(int robotID, long targID);
-    std::vector<int> robotColliders(int robotID);
-    std::vector<int> fiducialColliders(int robotID);
+    std::tuple<bool, bool, std::vector<int>> isCollidedWithAssigned(int robotID) const;
+    std::tuple<bool, bool, std::vector<int>> wouldCollideWithAssigned(int robotID, long targID) const; // nothing is assigned or moved
+    void buildConflictGraph(int nThreads = 0); // rebuild after targets change
+    int conflictNode(int robotID, long targID) const; // -1 if not a valid pair
+    bool nodesConflict(int node1, int node2) const;
+    std::vector<int> robotColliders(int robotID) const;
+    std::vector<int> fiducialColliders(int robotID) const;
+    std::vector<int> robotCollidersAt(int robotID, double alpha, double beta) const; // hypothetical pose
+    std::vector<int> fiducialCollidersAt(int robotID, double alpha, double beta) const; // hypothetical pose
     bool neighborEncroachment(std::shared_ptr<Robot> r1);
+    double clearance(int robotID);
+    bool isClearForStep(std::shared_ptr<Robot> r1, int stepNum);
     // bool isFiducialCollided(std::shared_ptr<Robot> r1);
     // bool isCollidedInd(int robotInd);
     void decollideRobot(int robotID);
@@ -92,6 +184,8 @@ public:
     void stepTowardFold(std::shared_ptr<Robot> r1, int stepNum);
     // void stepEuclidean(std::shared_ptr<Robot> r1, int stepNum);
     void stepGreedy(std::shared_ptr<Robot> r1, int stepNum);
+    void stepGreedy(std::shared_ptr<Robot> r1, int stepNum, std::vector<vec2> & perturbations, std::mt19937 * rng, long & nSkipped);
+    void stepGreedyMulti(std::shared_ptr<Robot> r1, int stepNum, int nSub);
     void stepMDP(std::shared_ptr<Robot> r1, int stepNum);
     void stepBeta(std::shared_ptr<Robot> r1, int stepNum);
     // double closestApproach2(int robotID); // squared distance to closest neighbor
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <vector>
 #include <array>
+#include <functional>
 // #include <Eigen/Dense>
 #include "coordio.h"
 
@@ -14,6 +15,14 @@ std::array<double, 2> sampleAnnulus(double rMin, double rMax);
 
 double linearInterpolate(std::vector<vec2> & sparseXYPoints, double xValue);
 
+double linearInterpolate(const std::vector<vec2> & sparseXYPoints, double xValue, int & cursor);
+
+void linearInterpolate(
+    const std::vector<vec2> & sparseXYPoints,
+    const std::vector<double> & xValues,
+    std::vector<double> & yValues
+);
+
 double dist3D_Segment_to_Segment(
     vec3 S1_P0, vec3 S1_P1,
     vec3 S2_P0, vec3 S2_P1);
@@ -24,8 +33,23 @@ double PerpendicularDistance(const vec2 &pt, const vec2 &lineStart, const vec2 &
 
 void RamerDouglasPeucker(const std::vector<vec2> &pointList, double epsilon, std::vector<vec2> &out);
 
+// line simplification for points arriving one at a time (sorted by x),
+// only the kept points and the open segment are stored.  Every dropped
+// point is within epsilon (in y) of the simplified line.
+struct StreamSimplifier {
+    double epsilon = 0;
+    int nOpen = -1; // points since the last kept point, -1 before the first
+    vec2 anchor, last; // last kept point, last point added
+    double minSlope, maxSlope; // slopes from anchor passing all open points
+    void reset(double epsilon);
+    void addPoint(const vec2 & point, std::vector<vec2> & out);
+    void finish(std::vector<vec2> & out); // keep the last point
+};
+
 double randomSample();
 
+void parallelFor(int nItems, int nThreads, const std::function<void(int)> & func);
+
 // double meanErrorRMD(
 //     // return the mean error between the rmd simplified line
 //     // and the original line, we'll use this to globally
@@ -7,6 +7,7 @@
 
 import os
 import json
+import mmap
 import pickle
 import numpy as np
 import fitsio
@@ -62,16 +63,16 @@ class RobotGrid(kaiju.cKaiju.RobotGrid):
     seed : int
         seed for random number generator when used
 
-    robotDict : dictionary of Robot class objects
+    robotDict : RobotDict, live dict-like map of Robot class objects
         all robots
 
     nRobots : int
         number of robots
 
-    fiducialDict : dictionary of Fiducial objects
+    fiducialDict : FiducialDict, live dict-like map of Fiducial objects
         positions of fiducials
 
-    targetDict : dictionary of Target class objects
+    targetDict : TargetDict, live dict-like map of Target class objects
         targets in field, with ID as keys
 
     smoothCollisions : int
@@ -255,6 +256,40 @@ class RobotGrid(kaiju.cKaiju.RobotGrid):
         self.robot_fromarray(robot_array)
         return
 
+    def saveSnapshot(self, filename):
+        """Write the full grid state (including paths) to a binary file
+
+        Parameters:
+        ----------
+
+        filename : str
+            snapshot file name to write to (clobbers)
+"""
+        with open(filename, "wb") as f:
+            f.write(self.snapshot())
+        return
+
+    def loadSnapshot(self, filename):
+        """Replace the grid with one written by saveSnapshot()
+
+        Parameters:
+        ----------
+
+        filename : str
+            snapshot file name to read from
+
+        Comments:
+        --------
+
+        The file is memory mapped, arrays are copied straight from the
+        mapping into the grid without any parsing.
+"""
+        with open(filename, "rb") as f:
+            with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as mm:
+                self.restore(mm)
+        self.stepSize = self.angStep
+        return
+
     def singleRobotDict(self, robot, downsample=None):
         """Dictionary for a single robot
 
@@ -317,8 +352,8 @@ class RobotGrid(kaiju.cKaiju.RobotGrid):
             "roughBetaY"
         ]
         for item in downsampleMe:
-            # these are all lists of numpy pairs
-            l = [list(x) for x in getattr(robot, item)]
+            # these are all N x 2 numpy views
+            l = getattr(robot, item).tolist()
             lastElement = l[-1]
             l = l[::downsample] + [lastElement]
             r[item] = l
@@ -328,21 +363,21 @@ class RobotGrid(kaiju.cKaiju.RobotGrid):
         r["smoothBetaVel"] = robot.smoothBetaVel
         # r["alphaPath"] = [list(x) for x in robot.alphaPath]
         # r["betaPath"] = [list(x) for x in robot.betaPath]
-        r["smoothedAlphaPath"] = [list(x) for x in robot.smoothedAlphaPath]
-        r["smoothedBetaPath"] = [list(x) for x in robot.smoothedBetaPath]
-        r["simplifiedAlphaPath"] = [list(x) for x in robot.simplifiedAlphaPath]
-        r["simplifiedBetaPath "] = [list(x) for x in robot.simplifiedBetaPath]
-        r["interpSimplifiedAlphaPath"] = [list(x) for x in robot.interpSimplifiedAlphaPath]
-        r["interpSimplifiedBetaPath "] = [list(x) for x in robot.interpSimplifiedBetaPath]
-        r["interpAlphaX"] = [list(x) for x in robot.interpAlphaX]
-        r["interpAlphaY"] = [list(x) for x in robot.interpAlphaY]
-        r["interpBetaX"] = [list(x) for x in robot.interpBetaX]
-        r["interpBetaY "] = [list(x) for x in robot.interpBetaY]
+        r["smoothedAlphaPath"] = robot.smoothedAlphaPath.tolist()
+        r["smoothedBetaPath"] = robot.smoothedBetaPath.tolist()
+        r["simplifiedAlphaPath"] = robot.simplifiedAlphaPath.tolist()
+        r["simplifiedBetaPath"] = robot.simplifiedBetaPath.tolist()
+        r["interpSimplifiedAlphaPath"] = robot.interpSimplifiedAlphaPath.tolist()
+        r["interpSimplifiedBetaPath"] = robot.interpSimplifiedBetaPath.tolist()
+        r["interpAlphaX"] = robot.interpAlphaX.tolist()
+        r["interpAlphaY"] = robot.interpAlphaY.tolist()
+        r["interpBetaX"] = robot.interpBetaX.tolist()
+        r["interpBetaY"] = robot.interpBetaY.tolist()
         # r["roughAlphaX"] = [list(x) for x in robot.roughAlphaX]
         # r["roughAlphaY"] = [list(x) for x in robot.roughAlphaY]
         # r["roughBetaX"] = [list(x) for x in robot.roughBetaX]
         # r["roughBetaY "] = [list(x) for x in robot.roughBetaY]
-        r["interpCollisions "] = [list(x) for x in robot.interpCollisions]
+        r["interpCollisions"] = robot.interpCollisions.tolist()
 
         r["robotNeighbors"] = robot.robotNeighbors
         r["fiducialNeighbors"] = robot.fiducialNeighbors
@@ -728,18 +763,17 @@ class RobotGrid(kaiju.cKaiju.RobotGrid):
         Does not clearTargetList() first, so will add targets to
         existing list.
 """
-        for it in np.arange(len(target_array)):
-            ft = target_array['fiberType'][it].decode().strip()
-            fiberType = str2FiberType[ft]
-            xyzWok = [
-                target_array['x'][it],
-                target_array['y'][it],
-                target_array['z'][it]
-            ]
-            self.addTarget(targetID=target_array['targetID'][it],
-                           xyzWok=xyzWok,
-                           fiberType=fiberType,
-                           priority=target_array['priority'][it])
+        fiberTypes = np.array([
+            int(str2FiberType[ft.decode().strip()])
+            for ft in target_array['fiberType']
+        ], dtype=np.int32)
+        xyzWok = np.column_stack(
+            [target_array['x'], target_array['y'], target_array['z']]
+        )
+        self.addTargets(targetIDs=target_array['targetID'],
+                        xyzWok=xyzWok,
+                        fiberTypes=fiberTypes,
+                        priorities=target_array['priority'].astype(np.float64))
         return
 
     def robot_fromarray(self, robot_array):
@@ -804,16 +838,16 @@ class RobotGrid(kaiju.cKaiju.RobotGrid):
 #     seed : int
 #         seed for random number generator when used
 
-#     robotDict : dictionary of Robot class objects
+#     robotDict : RobotDict, live dict-like map of Robot class objects
 #         all robots
 
 #     nRobots : int
 #         number of robots
 
-#     fiducialDict : dictionary of Fiducial objects
+#     fiducialDict : FiducialDict, live dict-like map of Fiducial objects
 #         positions of fiducials
 
-#     targetDict : dictionary of Target class objects
+#     targetDict : TargetDict, live dict-like map of Target class objects
 #         targets in field, with ID as keys
 
 #     smoothCollisions : int
@@ -905,16 +939,16 @@ class RobotGridAPO(RobotGrid):
     seed : int
         seed for random number generator when used
 
-    robotDict : dictionary of Robot class objects
+    robotDict : RobotDict, live dict-like map of Robot class objects
         all robots
 
     nRobots : int
         number of robots
 
-    fiducialDict : dictionary of Fiducial objects
+    fiducialDict : FiducialDict, live dict-like map of Fiducial objects
         positions of fiducials
 
-    targetDict : dictionary of Target class objects
+    targetDict : TargetDict, live dict-like map of Target class objects
         targets in field, with ID as keys
 
     smoothCollisions : int
@@ -63,11 +63,12 @@ def getSources():
         'src/utils.cpp',
         'src/target.cpp',
         'src/fiducial.cpp',
+        'src/snapshot.cpp',
         getCoordioSrc()
     ]
 
-extra_compile_args = ["--std=c++11", "-fPIC", "-v", "-O3"]
-extra_link_args = None
+extra_compile_args = ["--std=c++11", "-fPIC", "-v", "-O3", "-pthread"]
+extra_link_args = ["-pthread"]
 if sys.platform == 'darwin':
     extra_compile_args += ['-stdlib=libc++', '-mmacosx-version-min=10.9']
     extra_link_args = ["-v", '-mmacosx-version-min=10.9']
@@ -1,15 +1,89 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/eigen.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
+#include <pybind11/stl_bind.h>
 #include "robotGrid.h"
 #include "target.h"
 #include "fiducial.h"
 // #include "coordio.h"
 
 
+// the grid's dicts are bound as live maps instead of being converted to
+// new python dicts on every attribute access
+PYBIND11_MAKE_OPAQUE(std::map<int, std::shared_ptr<Robot>>);
+PYBIND11_MAKE_OPAQUE(std::map<int, std::shared_ptr<Fiducial>>);
+PYBIND11_MAKE_OPAQUE(std::map<long, std::shared_ptr<Target>>);
+
 namespace py = pybind11;
 using namespace pybind11::literals;
 
+typedef std::vector<vec2> Robot::* RobotPath;
+
+// N x 2 read only numpy view straight onto a robot's path vector, nothing
+// is copied.  The view keeps the robot alive but is only valid until that
+// path is regenerated or cleared (copy it to keep it longer).
+py::cpp_function pathGetter(RobotPath path){
+    return py::cpp_function([path](py::object self){
+        const std::vector<vec2> & points = self.cast<Robot &>().*path;
+        py::array_t<double> view(
+            {(py::ssize_t)points.size(), (py::ssize_t)2},
+            {(py::ssize_t)sizeof(vec2), (py::ssize_t)sizeof(double)},
+            points.empty() ? nullptr : points[0].data(), self
+        );
+        view.attr("setflags")("write"_a = false);
+        return view;
+    });
+}
+
+// 1D read only numpy view onto one of the grid's conflict graph arrays,
+// valid until the next buildConflictGraph (copy it to keep it longer)
+template <typename T>
+py::cpp_function graphArrayGetter(std::vector<T> RobotGrid::* member){
+    return py::cpp_function([member](py::object self){
+        const std::vector<T> & values = self.cast<RobotGrid &>().*member;
+        py::array_t<T> view(
+            (py::ssize_t)values.size(), values.empty() ? nullptr : values.data(), self
+        );
+        view.attr("setflags")("write"_a = false);
+        return view;
+    });
+}
+
+py::cpp_function pathSetter(RobotPath path){
+    return py::cpp_function([path](Robot & robot, std::vector<vec2> points){
+        robot.*path = points;
+    });
+}
+
+// restore straight from any contiguous buffer (bytes, mmap, numpy.memmap),
+// so a mapped snapshot file is never copied into a python object
+void restoreFromBuffer(RobotGrid & rg, py::buffer data){
+    py::buffer_info info = data.request();
+    if (info.ndim != 1 || info.strides[0] != info.itemsize){
+        throw std::runtime_error("Snapshot buffer must be 1D and contiguous");
+    }
+    rg.restore((const char *)info.ptr, info.size * info.itemsize);
+}
+
+// a live map without bind_map's __setitem__/__delitem__.  Robots, targets
+// and fiducials are added and removed through RobotGrid so the valid
+// target lists and reach index stay in step, writing a map directly
+// would leave them pointing at missing entries
+template <typename Map>
+void bindReadOnlyMap(py::module & m, const char * name){
+    auto cl = py::bind_map<Map>(m, name);
+    std::string error = std::string(name) + " is read only, use the RobotGrid methods to change it";
+    cl.attr("__setitem__") = py::cpp_function(
+        [error](Map &, py::object, py::object){ throw py::type_error(error); },
+        py::is_method(cl)
+    );
+    cl.attr("__delitem__") = py::cpp_function(
+        [error](Map &, py::object){ throw py::type_error(error); },
+        py::is_method(cl)
+    );
+}
+
 PYBIND11_MODULE(cKaiju, m) {
     py::enum_<FiberType>(m, "FiberType", py::arithmetic())
         .value("MetrologyFiber", MetrologyFiber)
@@ -56,6 +130,9 @@ PYBIND11_MODULE(cKaiju, m) {
         .def_readwrite("fiducialNeighbors", &Robot::fiducialNeighbors)
         .def_readwrite("angStep", &Robot::angStep)
         .def_readwrite("collisionBuffer", &Robot::collisionBuffer)
+        .def_readwrite("clearance", &Robot::clearance)
+        .def_readwrite("fiberReach", &Robot::fiberReach)
+        .def_readwrite("useCostField", &Robot::useCostField)
         .def_readwrite("lastStepNum", &Robot::lastStepNum)
         .def_readwrite("destinationAlpha", &Robot::destinationAlpha)
         .def_readwrite("destinationBeta", &Robot::destinationBeta)
@@ -79,27 +156,31 @@ PYBIND11_MODULE(cKaiju, m) {
         .def_readwrite("id", &Robot::id)
         .def_readwrite("holeID", &Robot::holeID)
         .def_readwrite("assignedTargetID", &Robot::assignedTargetID)
-        .def_readwrite("alphaPath", &Robot::alphaPath)
-        .def_readwrite("betaPath", &Robot::betaPath)
+        .def_property("alphaPath", pathGetter(&Robot::alphaPath), pathSetter(&Robot::alphaPath))
+        .def_property("betaPath", pathGetter(&Robot::betaPath), pathSetter(&Robot::betaPath))
         // .def_readwrite("onTargetVec", &Robot::onTargetVec)
-        .def_readwrite("smoothedAlphaPath", &Robot::smoothedAlphaPath)
-        .def_readwrite("smoothedBetaPath", &Robot::smoothedBetaPath)
-        .def_readwrite("simplifiedAlphaPath", &Robot::simplifiedAlphaPath)
-        .def_readwrite("simplifiedBetaPath", &Robot::simplifiedBetaPath)
-        .def_readwrite("interpSimplifiedAlphaPath", &Robot::interpSimplifiedAlphaPath)
-        .def_readwrite("interpSimplifiedBetaPath", &Robot::interpSimplifiedBetaPath)
-        .def_readwrite("interpAlphaX", &Robot::interpAlphaX)
-        .def_readwrite("interpAlphaY", &Robot::interpAlphaY)
-        .def_readwrite("interpBetaX", &Robot::interpBetaX)
-        .def_readwrite("interpBetaY", &Robot::interpBetaY)
-        .def_readwrite("roughAlphaX", &Robot::roughAlphaX)
-        .def_readwrite("roughAlphaY", &Robot::roughAlphaY)
-        .def_readwrite("roughBetaX", &Robot::roughBetaX)
-        .def_readwrite("roughBetaY", &Robot::roughBetaY)
-        .def_readwrite("interpCollisions", &Robot::interpCollisions)
+        .def_property("smoothedAlphaPath", pathGetter(&Robot::smoothedAlphaPath), pathSetter(&Robot::smoothedAlphaPath))
+        .def_property("smoothedBetaPath", pathGetter(&Robot::smoothedBetaPath), pathSetter(&Robot::smoothedBetaPath))
+        .def_property("simplifiedAlphaPath", pathGetter(&Robot::simplifiedAlphaPath), pathSetter(&Robot::simplifiedAlphaPath))
+        .def_property("simplifiedBetaPath", pathGetter(&Robot::simplifiedBetaPath), pathSetter(&Robot::simplifiedBetaPath))
+        .def_property("interpSimplifiedAlphaPath", pathGetter(&Robot::interpSimplifiedAlphaPath), pathSetter(&Robot::interpSimplifiedAlphaPath))
+        .def_property("interpSimplifiedBetaPath", pathGetter(&Robot::interpSimplifiedBetaPath), pathSetter(&Robot::interpSimplifiedBetaPath))
+        .def_property("interpAlphaX", pathGetter(&Robot::interpAlphaX), pathSetter(&Robot::interpAlphaX))
+        .def_property("interpAlphaY", pathGetter(&Robot::interpAlphaY), pathSetter(&Robot::interpAlphaY))
+        .def_property("interpBetaX", pathGetter(&Robot::interpBetaX), pathSetter(&Robot::interpBetaX))
+        .def_property("interpBetaY", pathGetter(&Robot::interpBetaY), pathSetter(&Robot::interpBetaY))
+        .def_property("roughAlphaX", pathGetter(&Robot::roughAlphaX), pathSetter(&Robot::roughAlphaX))
+        .def_property("roughAlphaY", pathGetter(&Robot::roughAlphaY), pathSetter(&Robot::roughAlphaY))
+        .def_property("roughBetaX", pathGetter(&Robot::roughBetaX), pathSetter(&Robot::roughBetaX))
+        .def_property("roughBetaY", pathGetter(&Robot::roughBetaY), pathSetter(&Robot::roughBetaY))
+        .def_property("interpCollisions", pathGetter(&Robot::interpCollisions), pathSetter(&Robot::interpCollisions))
+        .def_property("retimedAlphaPath", pathGetter(&Robot::retimedAlphaPath), pathSetter(&Robot::retimedAlphaPath))
+        .def_property("retimedBetaPath", pathGetter(&Robot::retimedBetaPath), pathSetter(&Robot::retimedBetaPath))
         .def("setAlphaBeta", &Robot::setAlphaBeta, R"pbdoc(
             A doc example
         )pbdoc")
+        .def("collisionSegAt", &Robot::collisionSegAt, "alpha"_a, "beta"_a)
+        .def("fiberWokXYZAt", &Robot::fiberWokXYZAt, "alpha"_a, "beta"_a, "fiberType"_a)
         .def("setDestinationAlphaBeta", &Robot::setDestinationAlphaBeta)
         .def("setXYUniform", &Robot::setXYUniform)
         .def("randomXYUniform", &Robot::randomXYUniform)
@@ -108,10 +189,16 @@ PYBIND11_MODULE(cKaiju, m) {
         // .def("isCollided", &Robot::isCollided)
         .def("setFiberToWokXYZ", &Robot::setFiberToWokXYZ)
         .def("score", &Robot::score)
+        .def("costToGo", &Robot::costToGo)
         // .def("decollide", &Robot::decollide)
         .def("getMaxReach", &Robot::getMaxReach)
         .def("isAssigned", &Robot::isAssigned);
 
+    // for lookup and iteration only
+    bindReadOnlyMap<std::map<int, std::shared_ptr<Robot>>>(m, "RobotDict");
+    bindReadOnlyMap<std::map<int, std::shared_ptr<Fiducial>>>(m, "FiducialDict");
+    bindReadOnlyMap<std::map<long, std::shared_ptr<Target>>>(m, "TargetDict");
+
     py::class_<RobotGrid, std::shared_ptr<RobotGrid>>(m, "RobotGrid", py::dynamic_attr(), R"pbdoc(
             Robot Grid Class
 
@@ -121,7 +208,7 @@ PYBIND11_MODULE(cKaiju, m) {
             "angStep"_a=1, "collisionBuffer"_a = 2, "epsilon"_a = 2, "seed"_a = 0)
         .def_readwrite("algType", &RobotGrid::algType)
         .def_readwrite("seed", &RobotGrid::seed)
-        .def_readwrite("robotDict", &RobotGrid::robotDict)
+        .def_readonly("robotDict", &RobotGrid::robotDict)
         .def_readwrite("greed", &RobotGrid::greed)
         .def_readwrite("phobia", &RobotGrid::phobia)
         .def_readwrite("angStep", &RobotGrid::angStep)
@@ -130,13 +217,37 @@ PYBIND11_MODULE(cKaiju, m) {
         .def_readwrite("didFail", &RobotGrid::didFail)
         .def_readwrite("nSteps", &RobotGrid::nSteps)
         .def_readwrite("nRobots", &RobotGrid::nRobots)
-        .def_readwrite("fiducialDict", &RobotGrid::fiducialDict)
-        .def_readwrite("targetDict", &RobotGrid::targetDict)
+        .def_readonly("fiducialDict", &RobotGrid::fiducialDict)
+        .def_readonly("targetDict", &RobotGrid::targetDict)
         .def_readwrite("maxPathSteps", &RobotGrid::maxPathSteps)
+        .def_readwrite("maxStepMultiplier", &RobotGrid::maxStepMultiplier)
+        .def_readwrite("nSweeps", &RobotGrid::nSweeps)
+        .def_readonly("nStepCalls", &RobotGrid::nStepCalls)
+        .def_readonly("nMultiSteps", &RobotGrid::nMultiSteps)
         .def_readwrite("maxDisplacement", &RobotGrid::maxDisplacement)
+        .def_readwrite("skipClearChecks", &RobotGrid::skipClearChecks)
+        .def_readwrite("nSkippedChecks", &RobotGrid::nSkippedChecks)
+        .def_readwrite("useCostFields", &RobotGrid::useCostFields)
+        .def_readwrite("clearanceSimplify", &RobotGrid::clearanceSimplify)
+        .def_readwrite("streamSimplify", &RobotGrid::streamSimplify)
+        .def_readonly("reachCellSize", &RobotGrid::reachCellSize)
+        .def_property_readonly("nodeRobotIDs", graphArrayGetter(&RobotGrid::nodeRobotIDs))
+        .def_property_readonly("nodeTargetIDs", graphArrayGetter(&RobotGrid::nodeTargetIDs))
+        .def_property_readonly("conflictStart", graphArrayGetter(&RobotGrid::conflictStart))
+        .def_property_readonly("conflictNodes", graphArrayGetter(&RobotGrid::conflictNodes))
+        .def_readwrite("stepTimes", &RobotGrid::stepTimes)
+        .def_readwrite("costFieldStep", &RobotGrid::costFieldStep)
+        .def_readwrite("maxClusterAttempts", &RobotGrid::maxClusterAttempts)
+        .def_readwrite("maxClusterExpansions", &RobotGrid::maxClusterExpansions)
+        .def_readonly("nClusterExpansions", &RobotGrid::nClusterExpansions)
         .def("throwAway", &RobotGrid::throwAway)
         .def("getNCollisions", &RobotGrid::getNCollisions)
         .def("deadlockedRobots", &RobotGrid::deadlockedRobots)
+        .def("deadlockedClusters", &RobotGrid::deadlockedClusters)
+        .def("solveCluster", &RobotGrid::solveCluster,
+            "robotIDs"_a, "maxExpansions"_a = 100000)
+        .def("resolveDeadlocks", &RobotGrid::resolveDeadlocks,
+            "maxClusterSize"_a = 30, "maxExpansions"_a = 100000)
         .def("addRobot", &RobotGrid::addRobot,
                 "robotID"_a, "holeID"_a, "basePos"_a, "iHat"_a, "jHat"_a,
                 "kHat"_a, "dxyz"_a, "alphaLen"_a, "alphaOffDeg"_a,
@@ -150,20 +261,66 @@ PYBIND11_MODULE(cKaiju, m) {
             "fiducialID"_a, "xyzWok"_a, "collisionBuffer"_a = 1.5)
         .def("addTarget", &RobotGrid::addTarget,
             "targetID"_a, "xyzWok"_a, "fiberType"_a, "priority"_a = 0)
+        .def("reachCandidates", &RobotGrid::reachCandidates, "xyzWok"_a)
+        .def("addTargets", &RobotGrid::addTargets,
+            "targetIDs"_a, "xyzWok"_a, "fiberTypes"_a, "priorities"_a, "nThreads"_a = 0)
+        .def("forwardKinematics", &RobotGrid::forwardKinematics,
+            "robotIDs"_a, "alphas"_a, "betas"_a, "nThreads"_a = 0)
+        .def("inverseKinematics", &RobotGrid::inverseKinematics,
+            "robotIDs"_a, "xyzWok"_a, "fiberTypes"_a, "nThreads"_a = 0)
+        .def("removeTargets", &RobotGrid::removeTargets, "targetIDs"_a)
+        .def("updateTargets", &RobotGrid::updateTargets,
+            "removeTargetIDs"_a, "targetIDs"_a, "xyzWok"_a, "fiberTypes"_a,
+            "priorities"_a, "nThreads"_a = 0)
         // .def("addTarget", &RobotGrid::addTarget,
         //     "targetID"_a, "x"_a, "y"_a, "fiberType"_a, "priority"_a = 0)
         .def("initGrid", &RobotGrid::initGrid)
-        // .def("optimizeTargets", &RobotGrid::optimizeTargets)
+        .def("optimizeTargets", &RobotGrid::optimizeTargets,
+            "usePriority"_a = true, "maxPasses"_a = 20, "nThreads"_a = 0)
         .def("decollideGrid", &RobotGrid::decollideGrid)
         .def("decollideRobot", &RobotGrid::decollideRobot)
         .def("homeRobot", &RobotGrid::homeRobot)
-        .def("simplifyPaths", &RobotGrid::simplifyPaths)
-        .def("smoothPaths", &RobotGrid::smoothPaths)
-        .def("verifySmoothed", &RobotGrid::verifySmoothed)
+        .def("simplifyPaths", &RobotGrid::simplifyPaths, "nThreads"_a = 0)
+        .def("roughClearances", &RobotGrid::roughClearances, "nThreads"_a = 0)
+        .def("smoothPaths", &RobotGrid::smoothPaths, "points"_a, "nThreads"_a = 0)
+        .def("verifySmoothed", &RobotGrid::verifySmoothed, "nThreads"_a = 0)
+        .def("verifyTrajectories", &RobotGrid::verifyTrajectories,
+            "robotIDs"_a, "alphas"_a, "betas"_a, "nThreads"_a = 0)
+        .def("retimePaths", &RobotGrid::retimePaths,
+            "maxAlphaSpeed"_a, "maxBetaSpeed"_a, "maxAlphaAccel"_a, "maxBetaAccel"_a)
+        .def("tuneSimplification", &RobotGrid::tuneSimplification,
+            "smoothPoints"_a, "minEpsilon"_a, "maxEpsilon"_a,
+            "tolerance"_a = 0.05, "nThreads"_a = 0)
         .def("setCollisionBuffer", &RobotGrid::setCollisionBuffer)
+        .def("snapshot", [](const RobotGrid & rg){
+            return py::bytes(rg.snapshot());
+        }, R"pbdoc(
+            Versioned binary copy of the whole grid: geometry, neighbors,
+            targets, assignments, poses, paths and the conflict graph.
+        )pbdoc")
+        .def("restore", &restoreFromBuffer, "data"_a, R"pbdoc(
+            Replace this grid with a snapshot from any bytes like object.
+            Pass an mmap of a snapshot file to load it without copying.
+        )pbdoc")
+        .def(py::pickle(
+            [](py::object self){
+                return py::make_tuple(
+                    py::bytes(self.cast<const RobotGrid &>().snapshot()),
+                    self.attr("__dict__")
+                );
+            },
+            [](py::tuple state){
+                auto rg = std::make_shared<RobotGrid>();
+                restoreFromBuffer(*rg, state[0].cast<py::buffer>());
+                return std::make_pair(rg, state[1].cast<py::dict>());
+            }
+        ))
         // .def("pathGen", &RobotGrid::pathGen)
         .def("pathGenGreedy", &RobotGrid::pathGenGreedy)
+        .def("pathGenTiled", &RobotGrid::pathGenTiled,
+            "tileSize"_a, "nThreads"_a = 0)
         .def("pathGenMDP", &RobotGrid::pathGenMDP)
+        .def("shortcutPaths", &RobotGrid::shortcutPaths, "nIterations"_a = 1000, "nThreads"_a = 0)
         // .def("setTargetList", &RobotGrid::setTargetList)
         // .def("addTargetList", &RobotGrid::addTargetList)
         .def("targetlessRobots", &RobotGrid::targetlessRobots)
@@ -176,14 +333,27 @@ PYBIND11_MODULE(cKaiju, m) {
         .def("unassignRobot", &RobotGrid::unassignRobot)
         .def("isValidAssignment", &RobotGrid::isValidAssignment,
             "robotID"_a, "targID"_a)
+        .def("canReach", &RobotGrid::canReach,
+            "robotID"_a, "xyzWok"_a, "fiberType"_a)
         .def("assignRobot2Target", &RobotGrid::assignRobot2Target,
             "robotID"_a, "targID"_a)
-        // .def("pairwiseSwap", &RobotGrid::pairwiseSwap)
+        .def("pairwiseSwap", &RobotGrid::pairwiseSwap,
+            "usePriority"_a = true, "maxPasses"_a = 20)
+        .def("greedyAssign", &RobotGrid::greedyAssign, "usePriority"_a = true)
         .def("unassignedRobots", &RobotGrid::unassignedRobots)
         .def("robotColliders", &RobotGrid::robotColliders)
         .def("fiducialColliders", &RobotGrid::fiducialColliders)
+        .def("robotCollidersAt", &RobotGrid::robotCollidersAt,
+            "robotID"_a, "alpha"_a, "beta"_a)
+        .def("fiducialCollidersAt", &RobotGrid::fiducialCollidersAt,
+            "robotID"_a, "alpha"_a, "beta"_a)
+        .def("clearance", &RobotGrid::clearance)
+        .def("buildCostField", &RobotGrid::buildCostField)
         .def("isCollidedWithAssigned", &RobotGrid::isCollidedWithAssigned)
         .def("wouldCollideWithAssigned", &RobotGrid::wouldCollideWithAssigned)
+        .def("buildConflictGraph", &RobotGrid::buildConflictGraph, "nThreads"_a = 0)
+        .def("conflictNode", &RobotGrid::conflictNode, "robotID"_a, "targID"_a)
+        .def("nodesConflict", &RobotGrid::nodesConflict, "node1"_a, "node2"_a)
         .def("isCollided", &RobotGrid::isCollided);
 }
 
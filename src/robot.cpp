@@ -3,6 +3,7 @@
 #include <cmath>
 #include <thread>
 #include <deque>
+#include <algorithm>
 #include "utils.h"
 #include "robot.h"
 #include "robotGrid.h"
@@ -194,7 +195,45 @@ void Robot::setFiberToWokXYZ(vec3 wokXYZ, FiberType fiberID){
 double Robot::score(){
     double alphaDist = alpha - destinationAlpha;
     double betaDist = beta - destinationBeta;
-    return alphaDist*alphaDist + betaDist*betaDist;
+    double dist2 = alphaDist*alphaDist + betaDist*betaDist;
+    if (!useCostField or dist2 == 0){
+        return dist2;
+    }
+    // squared cost to go in degrees, with a small amount of
+    // angular distance to break ties where the field is flat
+    double cost = costToGo() * costFieldStep;
+    return cost*cost + 0.01*dist2;
+}
+
+double Robot::costToGo(){
+    // bilinear interpolation of the cost field at the current alpha/beta.
+    // Corners that are blocked or unreachable are left out of the
+    // weighting, otherwise a robot passing close by a fiducial would see
+    // a cliff in the field and could stall beside it
+    double fAlpha = alpha / costFieldStep;
+    double fBeta = beta / costFieldStep;
+    int ia = std::min(std::max((int)floor(fAlpha), 0), costFieldNAlpha - 2);
+    int ib = std::min(std::max((int)floor(fBeta), 0), costFieldNBeta - 2);
+    double ta = std::min(std::max(fAlpha - ia, 0.0), 1.0);
+    double tb = std::min(std::max(fBeta - ib, 0.0), 1.0);
+    float unreachable = (float)costField.size();
+    double cost = 0;
+    double weightSum = 0;
+    for (int da=0; da<2; da++){
+        for (int db=0; db<2; db++){
+            double c = costField[(ia+da)*costFieldNBeta + ib + db];
+            if (c >= unreachable){
+                continue;
+            }
+            double weight = (da ? ta : 1-ta) * (db ? tb : 1-tb);
+            cost += weight*c;
+            weightSum += weight;
+        }
+    }
+    if (weightSum == 0){
+        return unreachable;
+    }
+    return cost / weightSum;
 }
 
 
@@ -202,6 +241,32 @@ double Robot::getMaxReach() {
 	return(maxReach);
 }
 
+double Robot::maxFiberReach() const {
+    // every fiber position is within alphaLen + |fiber beta xy| of the
+    // alpha axis in tangent coords.  Map that circle to the wok, the
+    // farthest point from the base bounds where targets can be reached.
+    // Sampled every 5 degrees, the margin covers the sampling and targets
+    // slightly off the focal surface
+    const double margin = 2; // mm
+    double reach2 = 0;
+    std::array<vec2, 3> fiberBetaXYs = {metBetaXY, apBetaXY, bossBetaXY};
+    for (auto & fiberBetaXY : fiberBetaXYs){
+        double radius = alphaLen + hypot(fiberBetaXY[0], fiberBetaXY[1]);
+        for (int ii=0; ii<72; ii++){
+            double theta = ii*5*M_PI/180;
+            vec3 tangentXYZ = {radius*cos(theta), radius*sin(theta), 0};
+            vec3 wokXYZ = tangentToWok(
+                tangentXYZ, basePos, iHat, jHat, kHat, elementHeight, scaleFac,
+                dxyz[0], dxyz[1], dxyz[2]
+            );
+            double dx = wokXYZ[0] - xPos;
+            double dy = wokXYZ[1] - yPos;
+            reach2 = std::max(reach2, dx*dx + dy*dy);
+        }
+    }
+    return sqrt(reach2) + margin;
+}
+
 void Robot::addRobotNeighbor(int robotID){
     robotNeighbors.push_back(robotID);
 }
@@ -216,6 +281,8 @@ void Robot::setDestinationAlphaBeta(double talpha, double tbeta){
     // double currBeta = beta;
     destinationAlpha = talpha;
     destinationBeta = tbeta;
+    // any cost field was built for the old destination
+    useCostField = false;
     // setAlphaBeta(talpha, tbeta); // to set metFiberPos
     // targMetFiberPos = metFiberPos;
     hasDestinationAlphaBeta = true;
@@ -223,63 +290,100 @@ void Robot::setDestinationAlphaBeta(double talpha, double tbeta){
 }
 
 void Robot::setAlphaBeta(double newAlpha, double newBeta){
-    vec2 tmp2;
-    vec3 tmp3;
-
     alpha = newAlpha;
     beta = newBeta;
-    vec2 alphaBeta = {newAlpha, newBeta};
+    metWokXYZ = fiberWokXYZAt(newAlpha, newBeta, MetrologyFiber);
+    bossWokXYZ = fiberWokXYZAt(newAlpha, newBeta, BossFiber);
+    apWokXYZ = fiberWokXYZAt(newAlpha, newBeta, ApogeeFiber);
 
-    // metrology fiber
-    tmp2 = positionerToTangent(
-        alphaBeta, metBetaXY, alphaLen, alphaOffDeg, betaOffDeg
-    );
-    tmp3 = {tmp2[0], tmp2[1], 0};
-    metWokXYZ = tangentToWok(
-        tmp3, basePos, iHat, jHat, kHat, elementHeight, scaleFac,
-        dxyz[0], dxyz[1], dxyz[2]
-    );
+    // collision segment
+    collisionSegWokXYZ = collisionSegAt(newAlpha, newBeta);
+}
 
-    // boss fiber
-    tmp2 = positionerToTangent(
-        alphaBeta, bossBetaXY, alphaLen, alphaOffDeg, betaOffDeg
+vec3 Robot::fiberWokXYZAt(double alpha, double beta, FiberType fiberType) const {
+    // wok xyz of a fiber at a hypothetical alpha/beta, pure kinematics
+    vec2 fibBetaXY;
+    if (fiberType == MetrologyFiber) {
+        fibBetaXY = metBetaXY;
+    }
+    else if (fiberType == ApogeeFiber){
+        fibBetaXY = apBetaXY;
+    }
+    else {
+        // boss fiber
+        fibBetaXY = bossBetaXY;
+    }
+    vec2 alphaBeta = {alpha, beta};
+    vec2 tmp2 = positionerToTangent(
+        alphaBeta, fibBetaXY, alphaLen, alphaOffDeg, betaOffDeg
     );
-    tmp3 = {tmp2[0], tmp2[1], 0};
-    bossWokXYZ = tangentToWok(
+    vec3 tmp3 = {tmp2[0], tmp2[1], 0};
+    return tangentToWok(
         tmp3, basePos, iHat, jHat, kHat, elementHeight, scaleFac,
         dxyz[0], dxyz[1], dxyz[2]
     );
+}
 
-    // apogee fiber
-    tmp2 = positionerToTangent(
-        alphaBeta, apBetaXY, alphaLen, alphaOffDeg, betaOffDeg
-    );
-    tmp3 = {tmp2[0], tmp2[1], 0};
-    apWokXYZ = tangentToWok(
-        tmp3, basePos, iHat, jHat, kHat, elementHeight, scaleFac,
-        dxyz[0], dxyz[1], dxyz[2]
-    );
+std::array<vec3, 2> Robot::collisionSegAt(double alpha, double beta) const {
+    // wok xyz of the collision segment ends at a hypothetical alpha/beta,
+    // pure kinematics, the robot's own state is left untouched
+    std::array<vec3, 2> collisionSeg;
+    vec2 alphaBeta = {alpha, beta};
+    for (int ii=0; ii<2; ii++){
+        vec2 tmp2 = positionerToTangent(
+            alphaBeta, collisionSegBetaXY[ii], alphaLen, alphaOffDeg, betaOffDeg
+        );
+        vec3 tmp3 = {tmp2[0], tmp2[1], 0};
+        collisionSeg[ii] = tangentToWok(
+            tmp3, basePos, iHat, jHat, kHat, elementHeight, scaleFac,
+            dxyz[0], dxyz[1], dxyz[2]
+        );
+    }
+    return collisionSeg;
+}
 
-    // collision segment
-    tmp2 = positionerToTangent(
-        alphaBeta, collisionSegBetaXY[0], alphaLen, alphaOffDeg, betaOffDeg
-    );
-    tmp3 = {tmp2[0], tmp2[1], 0};
-    collisionSegWokXYZ[0] = tangentToWok(
-        tmp3, basePos, iHat, jHat, kHat, elementHeight, scaleFac,
-        dxyz[0], dxyz[1], dxyz[2]
-    );
+void Robot::addPathPoint(int stepNum){
+    // record the current alpha/beta and collision segment
+    // ends as the path point for this step
+    vec2 temp;
+    temp[0] = stepNum;
+    if (streamPath){
+        temp[1] = alpha;
+        alphaStream.addPoint(temp, simplifiedAlphaPath);
+        temp[1] = beta;
+        betaStream.addPoint(temp, simplifiedBetaPath);
+        return;
+    }
+    temp[1] = alpha;
+    alphaPath.push_back(temp);
+    temp[1] = beta;
+    betaPath.push_back(temp);
+
+    // note make collision segment just two points
+    temp[1] = collisionSegWokXYZ[0][0]; // xAlphaEnd
+    roughAlphaX.push_back(temp);
+    temp[1] = collisionSegWokXYZ[0][1]; // yAlphaEnd
+    roughAlphaY.push_back(temp);
+    temp[1] = collisionSegWokXYZ.back()[0]; // xBetaEnd
+    roughBetaX.push_back(temp);
+    temp[1] = collisionSegWokXYZ.back()[1]; // yBetaEnd
+    roughBetaY.push_back(temp);
+}
 
-    tmp2 = positionerToTangent(
-        alphaBeta, collisionSegBetaXY[1], alphaLen, alphaOffDeg, betaOffDeg
-    );
-    tmp3 = {tmp2[0], tmp2[1], 0};
-    collisionSegWokXYZ[1] = tangentToWok(
-        tmp3, basePos, iHat, jHat, kHat, elementHeight, scaleFac,
-        dxyz[0], dxyz[1], dxyz[2]
-    );
+void Robot::startStream(double epsilon){
+    // path points from here on go straight into the sparse simplified
+    // paths, memory grows with the number of corners not the steps
+    simplifiedAlphaPath.clear();
+    simplifiedBetaPath.clear();
+    alphaStream.reset(epsilon);
+    betaStream.reset(epsilon);
+    streamPath = true;
 }
 
+void Robot::finishStream(){
+    alphaStream.finish(simplifiedAlphaPath);
+    betaStream.finish(simplifiedBetaPath);
+}
 
 vec2 Robot::randomXYUniform(){
 	vec2 xy = sampleAnnulus(minReach, maxReach);
@@ -313,103 +417,55 @@ void Robot::smoothVelocity(int points){
     if (alphaPath.size()==0){
         throw std::runtime_error("Cannot smooth, no alphaPath, do path gen first");
     }
-
-
-    // std::vector<double> movingWindow;
-    std::vector<double> bufferedAlphaVel;
-    std::vector<double> bufferedBetaVel;
-    vec2 temp;
-
-    // extend path on left (fake constant speed)
-    // as if the positioner kept moving to make sure
-    // we don't decelerate to a stop
-
-    // target position
-    double alphaStart = alphaPath[0][1];
-    double betaStart = betaPath[0][1];
-    double alphaEnd = alphaPath.back()[1];
-    double betaEnd = betaPath.back()[1];
-
-    for (int ii=0; ii < points; ii++){
-        // movingWindow.push_back(1/float(points));
-        // beta is moving towards 180 (positive)
-        // alpha is moving towards 0 (negative)
-        bufferedAlphaVel.push_back(-angStep);
-        bufferedBetaVel.push_back(angStep);
+    if (points < 1){
+        throw std::runtime_error("Cannot smooth, points must be positive");
     }
 
-
-    // begin creating the buffered velocity starts at 0
-
-    // calculate velocity vs step
-    // add tail points to alpha and beta paths
+    // the velocity series being smoothed is, in order:
+    // points lead in steps at full speed (alpha towards 0, beta
+    // towards 180) as if the positioner were already moving, so we
+    // don't decelerate to a stop, then the step to step path
+    // velocities with tailPoints zero velocity steps after the path
+    // ends to leave room for deceleration, then points copies of the
+    // last velocity so the averaging window never runs off the end.
+    // The series is indexed on the fly rather than built
     int tailPoints = 400; // should be more than enough
-    auto apCopy = alphaPath;
-    auto bpCopy = betaPath;
-    auto apLast = alphaPath.back();
-    auto bpLast = betaPath.back();
-    for (int ii=0; ii < tailPoints; ii++){
-        apCopy.push_back(apLast);
-        bpCopy.push_back(bpLast);
-    }
-
-    for (int ii=1; ii < apCopy.size(); ii++){
-        double av = apCopy[ii][1] - apCopy[ii-1][1];
-        double bv = bpCopy[ii][1] - bpCopy[ii-1][1];
-        bufferedAlphaVel.push_back(av);
-        bufferedBetaVel.push_back(bv);
-        // unbuffered version, for plotting if ya want
-        alphaVel.push_back(av);
-        betaVel.push_back(bv);
-    }
-
-    // alphaVel.push_back(0);
-    // betaVel.push_back(0);
-
-    // do i need to add zeros to alpha/betaVel
+    int nPathVel = alphaPath.size() - 1 + tailPoints;
+    int nBuffered = points + nPathVel + points;
+    auto pathVel = [](std::vector<vec2> & path, int ii){
+        // velocity of path step ii+1, the padded tail doesn't move
+        if (ii + 1 >= (int)path.size()){
+            return 0.0;
+        }
+        return path[ii+1][1] - path[ii][1];
+    };
+    auto bufferedVel = [&](std::vector<vec2> & path, double leadVel, int ii){
+        if (ii < points){
+            return leadVel;
+        }
+        return pathVel(path, std::min(ii - points, nPathVel - 1));
+    };
 
-    // add zero buffer to end of velocity array to make sure convolution
-    // works
-    double lastAlphaVel = bufferedAlphaVel.back();
-    double lastBetaVel = bufferedBetaVel.back();
-    for (int ii=0; ii < points; ii++){
-        bufferedAlphaVel.push_back(lastAlphaVel); // add zeros on right of velocities
-        bufferedBetaVel.push_back(lastBetaVel);
+    // unbuffered velocities, for plotting if ya want
+    for (int ii=0; ii < nPathVel; ii++){
+        alphaVel.push_back(pathVel(alphaPath, ii));
+        betaVel.push_back(pathVel(betaPath, ii));
     }
 
-
-    for (int ii=points; ii < bufferedAlphaVel.size()-points; ii++){
-
-        double alphaAvg = 0;
-        double betaAvg = 0;
-        int pp = 0;
-        for (int jj=0; jj<points; jj++){
-            // choose numerically stable average (not yet implemented?)
-            if (jj==0){
-                alphaAvg += bufferedAlphaVel[jj+ii];
-                betaAvg += bufferedBetaVel[jj+ii];
-                pp++;
-            }
-            else{
-                alphaAvg += bufferedAlphaVel[ii-jj];
-                betaAvg += bufferedBetaVel[ii-jj];
-                alphaAvg += bufferedAlphaVel[ii+jj];
-                betaAvg += bufferedBetaVel[ii+jj];
-                pp++;
-                pp++;
-            }
-        }
-        // std::cout << "points averaged " << pp << std::endl;
-        alphaAvg = alphaAvg / ((float)pp);
-        betaAvg = betaAvg / ((float)pp);
-        smoothAlphaVel.push_back(alphaAvg);
-        smoothBetaVel.push_back(betaAvg);
-
+    // symmetric moving average over 2*points-1 velocities, kept as
+    // a running sum as the window slides
+    int windowSize = 2*points - 1;
+    double alphaSum = 0;
+    double betaSum = 0;
+    for (int ii=1; ii < 2*points; ii++){
+        alphaSum += bufferedVel(alphaPath, -angStep, ii);
+        betaSum += bufferedVel(betaPath, angStep, ii);
     }
 
-    // convert back into position / time series, a cumulative sum
-    double cumSumAlpha = alphaStart;
-    double cumSumBeta = betaStart;
+    // integrate back into a position / time series as we go
+    vec2 temp;
+    double cumSumAlpha = alphaPath[0][1];
+    double cumSumBeta = betaPath[0][1];
     int cumStep = 0;
     temp[0] = cumStep;
     temp[1] = cumSumAlpha;
@@ -418,10 +474,20 @@ void Robot::smoothVelocity(int points){
     smoothedBetaPath.push_back(temp);
     cumStep++;
 
-    for (int ii=0; ii < smoothAlphaVel.size(); ii++){
-        cumSumAlpha += smoothAlphaVel[ii];
-        cumSumBeta += smoothBetaVel[ii];
-        // std::cout << "beta pos " << cumSumBeta << std::endl;
+    for (int ii=points; ii < nBuffered - points; ii++){
+        if (ii > points){
+            alphaSum += bufferedVel(alphaPath, -angStep, ii + points - 1)
+                        - bufferedVel(alphaPath, -angStep, ii - points);
+            betaSum += bufferedVel(betaPath, angStep, ii + points - 1)
+                       - bufferedVel(betaPath, angStep, ii - points);
+        }
+        double alphaAvg = alphaSum / windowSize;
+        double betaAvg = betaSum / windowSize;
+        smoothAlphaVel.push_back(alphaAvg);
+        smoothBetaVel.push_back(betaAvg);
+
+        cumSumAlpha += alphaAvg;
+        cumSumBeta += betaAvg;
         temp[0] = cumStep;
         temp[1] = cumSumAlpha;
         smoothedAlphaPath.push_back(temp);
@@ -439,22 +505,19 @@ void Robot::smoothVelocity(int points){
     // add a small error in position (like 1e-16) so just tag it
     // for the rmd smoother
     temp[0] = cumStep;
-    temp[1] = alphaEnd;
+    temp[1] = alphaPath.back()[1];
     smoothedAlphaPath.push_back(temp);
-    temp[1] = betaEnd;
+    temp[1] = betaPath.back()[1];
     smoothedBetaPath.push_back(temp);
 
 }
 
 void Robot::simplifyPath(double epsilon){
     // smooth a previously generated path
-    double interpSimplifiedAlpha, interpSimplifiedBeta;
-
     if (alphaPath.size()==0){
         throw std::runtime_error("Cannot simplify, no smoothed paths, pathgen, and smooth first");
     }
     // int npts;
-    vec2 atemp, btemp;
 
     // because we extended the tail of the smoothed alpha beta paths to
     // allow deceleration, begin truncating it until we detect that the
@@ -476,41 +539,166 @@ void Robot::simplifyPath(double epsilon){
     // send the shortest path possible to the bot.
     vec2 insertAlpha, insertBeta, currPos;
 
+    interpolateSimplified();
+}
+
+void Robot::simplifyPathWithin(double epsilon, const std::vector<double> & maxDeviation){
+    // like simplifyPath, but at every path step the collision segment
+    // ends must stay within maxDeviation[step] (mm) of where the rough
+    // path had them.  Wherever the RDP points stray too far the worst
+    // step is anchored, to the smoothed pose if that is close enough,
+    // otherwise to the rough pose itself, until every step fits
+    if (smoothedAlphaPath.size()==0){
+        throw std::runtime_error("Cannot simplify, no smoothed paths, pathgen, and smooth first");
+    }
+    if (maxDeviation.size() < alphaPath.size()){
+        throw std::runtime_error("Need a maxDeviation for every path step");
+    }
+    RamerDouglasPeucker(smoothedAlphaPath, epsilon, simplifiedAlphaPath);
+    RamerDouglasPeucker(smoothedBetaPath, epsilon, simplifiedBetaPath);
+
+    int nDensePoints = alphaPath.size();
+    std::vector<double> xVals(nDensePoints), interpAlphas, interpBetas;
+    std::vector<std::array<vec3, 2>> roughSegs(nDensePoints);
+    for (int ii=0; ii<nDensePoints; ii++){
+        xVals[ii] = alphaPath[ii][0];
+        roughSegs[ii] = collisionSegAt(alphaPath[ii][1], betaPath[ii][1]);
+    }
+    auto excess = [&](int ii, double alpha, double beta){
+        // how far past its allowance a pose at step ii is
+        auto collisionSeg = collisionSegAt(alpha, beta);
+        double dist2 = 0;
+        for (int jj=0; jj<2; jj++){
+            double dx = collisionSeg[jj][0] - roughSegs[ii][jj][0];
+            double dy = collisionSeg[jj][1] - roughSegs[ii][jj][1];
+            double dz = collisionSeg[jj][2] - roughSegs[ii][jj][2];
+            dist2 = std::max(dist2, dx*dx + dy*dy + dz*dz);
+        }
+        return sqrt(dist2) - maxDeviation[ii];
+    };
+    auto anchor = [](std::vector<vec2> & sparse, vec2 pt){
+        // insert (or replace) a point, keeping x sorted
+        auto it = std::lower_bound(
+            sparse.begin(), sparse.end(), pt,
+            [](const vec2 & a, const vec2 & b){ return a[0] < b[0]; }
+        );
+        if (it != sparse.end() && (*it)[0] == pt[0]){
+            *it = pt;
+        }
+        else {
+            sparse.insert(it, pt);
+        }
+    };
+
+    while (true){
+        linearInterpolate(simplifiedAlphaPath, xVals, interpAlphas);
+        linearInterpolate(simplifiedBetaPath, xVals, interpBetas);
+        // worst step of every run of steps over their allowance
+        std::vector<int> worstSteps;
+        int worstStep = -1;
+        double worstExcess = 0;
+        for (int ii=0; ii<nDensePoints; ii++){
+            double stepExcess = excess(ii, interpAlphas[ii], interpBetas[ii]);
+            if (stepExcess > 0){
+                if (worstStep == -1 || stepExcess > worstExcess){
+                    worstStep = ii;
+                    worstExcess = stepExcess;
+                }
+            }
+            else if (worstStep != -1){
+                worstSteps.push_back(worstStep);
+                worstStep = -1;
+            }
+        }
+        if (worstStep != -1){
+            worstSteps.push_back(worstStep);
+        }
+        if (worstSteps.size() == 0){
+            break;
+        }
+        // an anchored step interpolates to exactly its anchor, so every
+        // step is anchored at most twice (smoothed, then rough)
+        for (auto ii : worstSteps){
+            double alpha = linearInterpolate(smoothedAlphaPath, xVals[ii]);
+            double beta = linearInterpolate(smoothedBetaPath, xVals[ii]);
+            if (excess(ii, alpha, beta) > 0){
+                alpha = alphaPath[ii][1];
+                beta = betaPath[ii][1];
+            }
+            anchor(simplifiedAlphaPath, {xVals[ii], alpha});
+            anchor(simplifiedBetaPath, {xVals[ii], beta});
+        }
+    }
+
+    interpolateSimplified();
+}
+
+void Robot::interpolateSimplified(){
+    // fill the dense interpolated simplified paths, and the collision
+    // segment xy along them, from the sparse simplified paths
+    double interpSimplifiedAlpha, interpSimplifiedBeta;
+    vec2 atemp, btemp;
 
     // calculate simplified alpha betas at every step
     // this is used for collision detection after smoothing
     // if alphaPath point is outside interpolation range
     // then simply extrapolate that postion
-    int nDensePoints = alphaPath.size();
+    // the dense steps are sorted, so interpolate them all in one
+    // pass through the sparse points
+    // streamed paths have no dense steps, use every step they span
+    // the simplified paths changed, an earlier retiming no longer fits
+    retimedAlphaPath.clear();
+    retimedBetaPath.clear();
+    std::vector<double> xVals, interpAlphas, interpBetas;
+    if (streamPath){
+        if (simplifiedAlphaPath.size() != 0){
+            for (double x = simplifiedAlphaPath[0][0]; x <= simplifiedAlphaPath.back()[0]; x++){
+                xVals.push_back(x);
+            }
+        }
+    }
+    else {
+        for (auto & pathPoint : alphaPath){
+            xVals.push_back(pathPoint[0]);
+        }
+    }
+    int nDensePoints = xVals.size();
+    linearInterpolate(simplifiedAlphaPath, xVals, interpAlphas);
+    linearInterpolate(simplifiedBetaPath, xVals, interpBetas);
     for (int ii=0; ii<nDensePoints; ii++){
-        double xVal = alphaPath[ii][0];
+        double xVal = xVals[ii];
         atemp[0] = xVal; // interpolation step
         btemp[0] = xVal;
-        interpSimplifiedAlpha = linearInterpolate(simplifiedAlphaPath, xVal);
+        interpSimplifiedAlpha = interpAlphas[ii];
         // bias alpha in positive direction because we're approaching zero
         atemp[1] = interpSimplifiedAlpha;
         interpSimplifiedAlphaPath.push_back(atemp);
-        interpSimplifiedBeta = linearInterpolate(simplifiedBetaPath, xVal);
+        interpSimplifiedBeta = interpBetas[ii];
         btemp[1] = interpSimplifiedBeta;
         interpSimplifiedBetaPath.push_back(btemp);
 
         // populate interpXY points for alpha/beta ends
-        setAlphaBeta(interpSimplifiedAlpha, interpSimplifiedBeta);
-        atemp[1] = collisionSegWokXYZ[0][0]; // xAlphaEnd
+        auto collisionSeg = collisionSegAt(interpSimplifiedAlpha, interpSimplifiedBeta);
+        atemp[1] = collisionSeg[0][0]; // xAlphaEnd
         interpAlphaX.push_back(atemp);
-        atemp[1] = collisionSegWokXYZ[0][1]; // yAlphaEnd
+        atemp[1] = collisionSeg[0][1]; // yAlphaEnd
         interpAlphaY.push_back(atemp);
-        atemp[1] = collisionSegWokXYZ.back()[0]; // xBetaEnd
+        atemp[1] = collisionSeg.back()[0]; // xBetaEnd
         interpBetaX.push_back(atemp);
-        atemp[1] = collisionSegWokXYZ.back()[1]; // yBetaEnd
+        atemp[1] = collisionSeg.back()[1]; // yBetaEnd
         interpBetaY.push_back(atemp);
 
     }
 
+    // finish at the last interpolated pose, like stepping through did
+    if (nDensePoints > 0){
+        setAlphaBeta(interpAlphas.back(), interpBetas.back());
+    }
+
 }
 
 
-vec2 Robot::alphaBetaFromWokXYZ(vec3 wokXYZ, FiberType fiberType){
+vec2 Robot::alphaBetaFromWokXYZ(vec3 wokXYZ, FiberType fiberType) const {
     // origin is at alpha axis
     // +x is aligned with alpha angle = 0
 
@@ -3,6 +3,12 @@
 // #include <Eigen/Dense>
 #include <algorithm>    // std::random_shuffle
 #include <chrono>       // std::chrono::system_clock
+#include <deque>
+#include <queue>
+#include <set>
+#include <tuple>
+#include <atomic>
+#include <limits>
 #include "utils.h"
 #include "robotGrid.h"
 
@@ -50,6 +56,8 @@ RobotGrid::RobotGrid(double angStep, double collisionBuffer, double epsilon, int
     smoothCollisions = 0;
     maxPathSteps = (int)(ceil(1000.0/angStep));
     maxDisplacement = 2*sin(angStep*M_PI/180)*(alphaLenRough+betaLenRough);
+    // cost field memory goes as 1/step^2, don't go finer than a degree
+    costFieldStep = std::max(angStep, 1.0);
 
     // construct the perturbation list
     for (int ii=-1; ii<2; ii++){
@@ -94,9 +102,11 @@ void RobotGrid::addTarget(long targetID, vec3 xyzWok, FiberType fiberType, doubl
     }
 
     targetDict[targetID] = std::make_shared<Target>(targetID, xyzWok, fiberType, priority);
-    // add target to robots and robots to target
-    for (auto rPair : robotDict){
-        auto r = rPair.second;
+    targetVersion++;
+    // add target to robots and robots to target, only robots
+    // whose reach covers the target need the full kinematics
+    for (auto robotID : reachCandidates(xyzWok)){
+        auto r = robotDict[robotID];
         if (isValidAssignment(r->id, targetID)){
             r->validTargetIDs.push_back(targetID);
             targetDict[targetID]->validRobotIDs.push_back(r->id);
@@ -104,6 +114,231 @@ void RobotGrid::addTarget(long targetID, vec3 xyzWok, FiberType fiberType, doubl
     }
 }
 
+std::vector<int> RobotGrid::reachCandidates(vec3 xyzWok){
+    // robots (in robotDict order) with the wok position inside their
+    // fiber reach, from the square of reachCells holding it
+    std::vector<int> robotIDs;
+    if (reachCellSize <= 0){
+        return robotIDs;
+    }
+    std::pair<int, int> cell(
+        (int)floor(xyzWok[0] / reachCellSize), (int)floor(xyzWok[1] / reachCellSize)
+    );
+    auto cellIt = reachCells.find(cell);
+    if (cellIt == reachCells.end()){
+        return robotIDs;
+    }
+    for (auto robotID : cellIt->second){
+        auto & r = robotDict.at(robotID);
+        double dx = xyzWok[0] - r->xPos;
+        double dy = xyzWok[1] - r->yPos;
+        if (dx*dx + dy*dy <= r->fiberReach*r->fiberReach){
+            robotIDs.push_back(robotID);
+        }
+    }
+    return robotIDs;
+}
+
+static void checkTargetArrays(
+    const Eigen::Ref<const VectorXi64> & targetIDs,
+    const Eigen::Ref<const RowMatrixX3d> & xyzWok,
+    const Eigen::Ref<const Eigen::VectorXi> & fiberTypes,
+    const Eigen::Ref<const Eigen::VectorXd> & priorities
+){
+    // row counts and fiber types of a batch of new targets
+    int nTargets = targetIDs.size();
+    if (xyzWok.rows() != nTargets || fiberTypes.size() != nTargets || priorities.size() != nTargets){
+        throw std::runtime_error("targetIDs, xyzWok, fiberTypes and priorities must have the same length");
+    }
+    for (int ii = 0; ii < nTargets; ii++){
+        if (fiberTypes[ii] < MetrologyFiber || fiberTypes[ii] > BossFiber){
+            throw std::runtime_error("Unknown fiber type");
+        }
+    }
+}
+
+void RobotGrid::addTargets(
+    const Eigen::Ref<const VectorXi64> & targetIDs,
+    const Eigen::Ref<const RowMatrixX3d> & xyzWok,
+    const Eigen::Ref<const Eigen::VectorXi> & fiberTypes,
+    const Eigen::Ref<const Eigen::VectorXd> & priorities, int nThreads
+){
+    // like calling addTarget for every row, in order.  The targets are
+    // checked against their candidate robots in parallel (canReach
+    // leaves the robots alone), then the
+    // dicts and valid ID lists are filled in one serial pass.  Nothing
+    // is added if any target is bad.
+    if (!initialized){
+        throw std::runtime_error("Initialize RobotGrid before adding targets");
+    }
+    checkTargetArrays(targetIDs, xyzWok, fiberTypes, priorities);
+    int nTargets = targetIDs.size();
+    std::set<long> newIDs;
+    for (int ii = 0; ii < nTargets; ii++){
+        if (targetDict.count(targetIDs[ii]) > 0 || !newIDs.insert(targetIDs[ii]).second){
+            throw std::runtime_error("Target ID already exists");
+        }
+    }
+
+    targetVersion++;
+    std::vector<std::vector<int>> validRobotIDs(nTargets);
+    parallelFor(nTargets, nThreads, [&](int ii){
+        vec3 xyz = {xyzWok(ii, 0), xyzWok(ii, 1), xyzWok(ii, 2)};
+        for (auto robotID : reachCandidates(xyz)){
+            if (canReach(robotID, xyz, (FiberType)fiberTypes[ii])){
+                validRobotIDs[ii].push_back(robotID);
+            }
+        }
+    });
+
+    for (int ii = 0; ii < nTargets; ii++){
+        long targetID = targetIDs[ii];
+        vec3 xyz = {xyzWok(ii, 0), xyzWok(ii, 1), xyzWok(ii, 2)};
+        auto target = std::make_shared<Target>(
+            targetID, xyz, (FiberType)fiberTypes[ii], priorities[ii]
+        );
+        targetDict[targetID] = target;
+        for (auto robotID : validRobotIDs[ii]){
+            robotDict.at(robotID)->validTargetIDs.push_back(targetID);
+        }
+        target->validRobotIDs = std::move(validRobotIDs[ii]);
+    }
+}
+
+std::tuple<RowMatrixX3d, RowMatrixX3d, RowMatrixX3d, RowMatrixX3d, RowMatrixX3d>
+RobotGrid::forwardKinematics(
+    const Eigen::Ref<const Eigen::VectorXi> & robotIDs,
+    const Eigen::Ref<const Eigen::VectorXd> & alphas,
+    const Eigen::Ref<const Eigen::VectorXd> & betas, int nThreads
+) const {
+    // wok xyz of the metrology, apogee and boss fibers and of the two
+    // collision segment ends for robotIDs[ii] at alphas[ii], betas[ii].
+    // A robot may appear more than once, none of them are moved
+    int nRows = robotIDs.size();
+    if (alphas.size() != nRows || betas.size() != nRows){
+        throw std::runtime_error("robotIDs, alphas and betas must have the same length");
+    }
+    std::vector<const Robot*> robots(nRows);
+    for (int ii = 0; ii < nRows; ii++){
+        auto robot = robotDict.find(robotIDs[ii]);
+        if (robot == robotDict.end()){
+            throw std::runtime_error("Robot ID does not exist");
+        }
+        robots[ii] = robot->second.get();
+    }
+    RowMatrixX3d met(nRows, 3), ap(nRows, 3), boss(nRows, 3), segStart(nRows, 3), segEnd(nRows, 3);
+    parallelFor(nRows, nThreads, [&](int ii){
+        auto robot = robots[ii];
+        auto metXYZ = robot->fiberWokXYZAt(alphas[ii], betas[ii], MetrologyFiber);
+        auto apXYZ = robot->fiberWokXYZAt(alphas[ii], betas[ii], ApogeeFiber);
+        auto bossXYZ = robot->fiberWokXYZAt(alphas[ii], betas[ii], BossFiber);
+        auto collisionSeg = robot->collisionSegAt(alphas[ii], betas[ii]);
+        for (int jj = 0; jj < 3; jj++){
+            met(ii, jj) = metXYZ[jj];
+            ap(ii, jj) = apXYZ[jj];
+            boss(ii, jj) = bossXYZ[jj];
+            segStart(ii, jj) = collisionSeg[0][jj];
+            segEnd(ii, jj) = collisionSeg[1][jj];
+        }
+    });
+    return std::make_tuple(met, ap, boss, segStart, segEnd);
+}
+
+RowMatrixX2d RobotGrid::inverseKinematics(
+    const Eigen::Ref<const Eigen::VectorXi> & robotIDs,
+    const Eigen::Ref<const RowMatrixX3d> & xyzWok,
+    const Eigen::Ref<const Eigen::VectorXi> & fiberTypes, int nThreads
+) const {
+    // alpha/beta putting fiberTypes[ii] of robotIDs[ii] on xyzWok[ii],
+    // as Robot::alphaBetaFromWokXYZ (nan where it can't reach)
+    int nRows = robotIDs.size();
+    if (xyzWok.rows() != nRows || fiberTypes.size() != nRows){
+        throw std::runtime_error("robotIDs, xyzWok and fiberTypes must have the same length");
+    }
+    std::vector<const Robot*> robots(nRows);
+    for (int ii = 0; ii < nRows; ii++){
+        auto robot = robotDict.find(robotIDs[ii]);
+        if (robot == robotDict.end()){
+            throw std::runtime_error("Robot ID does not exist");
+        }
+        if (fiberTypes[ii] < MetrologyFiber || fiberTypes[ii] > BossFiber){
+            throw std::runtime_error("Unknown fiber type");
+        }
+        robots[ii] = robot->second.get();
+    }
+    RowMatrixX2d alphaBetas(nRows, 2);
+    parallelFor(nRows, nThreads, [&](int ii){
+        vec3 xyz = {xyzWok(ii, 0), xyzWok(ii, 1), xyzWok(ii, 2)};
+        auto ab = robots[ii]->alphaBetaFromWokXYZ(xyz, (FiberType)fiberTypes[ii]);
+        alphaBetas(ii, 0) = ab[0];
+        alphaBetas(ii, 1) = ab[1];
+    });
+    return alphaBetas;
+}
+
+void RobotGrid::removeTargets(std::vector<long> targetIDs){
+    // drop targets from targetDict and from the valid lists of the
+    // robots that could reach them, releasing any robot assigned to
+    // one.  Nothing is removed if any ID is unknown.
+    std::set<long> removeIDs;
+    for (auto targetID : targetIDs){
+        if (targetDict.count(targetID) == 0){
+            throw std::runtime_error("Target ID does not exist");
+        }
+        removeIDs.insert(targetID);
+    }
+    std::set<int> affectedRobotIDs;
+    for (auto targetID : removeIDs){
+        auto target = targetDict[targetID];
+        unassignTarget(targetID);
+        affectedRobotIDs.insert(target->validRobotIDs.begin(), target->validRobotIDs.end());
+        targetDict.erase(targetID);
+    }
+    for (auto robotID : affectedRobotIDs){
+        auto & validTargetIDs = robotDict.at(robotID)->validTargetIDs;
+        validTargetIDs.erase(
+            std::remove_if(
+                validTargetIDs.begin(), validTargetIDs.end(),
+                [&](long targetID){ return removeIDs.count(targetID) > 0; }
+            ),
+            validTargetIDs.end()
+        );
+    }
+    targetVersion++;
+}
+
+void RobotGrid::updateTargets(
+    std::vector<long> removeTargetIDs,
+    const Eigen::Ref<const VectorXi64> & targetIDs,
+    const Eigen::Ref<const RowMatrixX3d> & xyzWok,
+    const Eigen::Ref<const Eigen::VectorXi> & fiberTypes,
+    const Eigen::Ref<const Eigen::VectorXd> & priorities, int nThreads
+){
+    // switch fields by difference: targets in both fields keep their
+    // valid robots and assignments, only removed and added ones cost
+    // anything.  An ID may be removed and re-added in the same update.
+    // Checked up front so a bad update changes nothing.
+    if (!initialized){
+        throw std::runtime_error("Initialize RobotGrid before adding targets");
+    }
+    checkTargetArrays(targetIDs, xyzWok, fiberTypes, priorities);
+    std::set<long> removeIDs(removeTargetIDs.begin(), removeTargetIDs.end());
+    for (auto targetID : removeIDs){
+        if (targetDict.count(targetID) == 0){
+            throw std::runtime_error("Target ID does not exist");
+        }
+    }
+    std::set<long> newIDs;
+    for (int ii = 0; ii < targetIDs.size(); ii++){
+        bool kept = targetDict.count(targetIDs[ii]) > 0 && removeIDs.count(targetIDs[ii]) == 0;
+        if (kept || !newIDs.insert(targetIDs[ii]).second){
+            throw std::runtime_error("Target ID already exists");
+        }
+    }
+    removeTargets(removeTargetIDs);
+    addTargets(targetIDs, xyzWok, fiberTypes, priorities, nThreads);
+}
+
 void RobotGrid::addFiducial(int fiducialID, vec3 xyzWok, double collisionBuffer){
     if (initialized){
         throw std::runtime_error("RobotGrid is already initialized, no more fiducials allowed");
@@ -155,6 +390,33 @@ void RobotGrid::initGrid(){
             }
         }
     }
+
+    for (auto rPair : robotDict){
+        rPair.second->fiberReach = rPair.second->maxFiberReach();
+    }
+    buildReachCells();
+}
+
+void RobotGrid::buildReachCells(){
+    // square cells as large as the longest reach, so addTarget
+    // only checks the few robots listed in a target's cell
+    reachCellSize = 0;
+    for (auto rPair : robotDict){
+        reachCellSize = std::max(reachCellSize, rPair.second->fiberReach);
+    }
+    reachCells.clear();
+    for (auto rPair : robotDict){
+        auto r = rPair.second;
+        int xMin = (int)floor((r->xPos - r->fiberReach) / reachCellSize);
+        int xMax = (int)floor((r->xPos + r->fiberReach) / reachCellSize);
+        int yMin = (int)floor((r->yPos - r->fiberReach) / reachCellSize);
+        int yMax = (int)floor((r->yPos + r->fiberReach) / reachCellSize);
+        for (int ix=xMin; ix<=xMax; ix++){
+            for (int iy=yMin; iy<=yMax; iy++){
+                reachCells[std::make_pair(ix, iy)].push_back(r->id);
+            }
+        }
+    }
 }
 
 std::shared_ptr<Robot> RobotGrid::getRobot(int robotID){
@@ -167,6 +429,8 @@ void RobotGrid::setCollisionBuffer(double newBuffer){
         auto r = rPair.second;
         r->setCollisionBuffer(newBuffer);
     }
+    // conflict graph edges were found at the old collision distance
+    targetVersion++;
 }
 
 void RobotGrid::decollideGrid(){
@@ -195,35 +459,788 @@ void RobotGrid::decollideGrid(){
 }
 
 
-void RobotGrid::smoothPaths(int points){
+// Flattened view of the grid for checking hypothetical poses from
+// worker threads, which then only read plain arrays.  Poses are given
+// as collision segments per robot index (robots in robotDict order).
+struct FiducialCheck {
+    int id;
+    vec3 xyzWok;
+    double collideDist2;
+};
+
+struct CollisionIndex {
+    std::vector<std::shared_ptr<Robot>> robots;
+    std::map<int, int> robotInds; // robot ID to index
+    std::vector<std::vector<int>> neighborInds; // both directions
+    std::vector<std::vector<int>> pairInds; // each pair once, from the lower index
+    std::vector<std::vector<FiducialCheck>> fiducialChecks;
+    double robotCollideDist;
+};
+
+static CollisionIndex collisionIndex(RobotGrid & grid){
+    CollisionIndex index;
+    for (auto rPair : grid.robotDict){
+        index.robotInds[rPair.first] = index.robots.size();
+        index.robots.push_back(rPair.second);
+    }
+    int nRobots = index.robots.size();
+    std::set<std::pair<int, int>> pairs;
+    for (int ii = 0; ii < nRobots; ii++){
+        for (auto neighborID : index.robots[ii]->robotNeighbors){
+            int jj = index.robotInds.at(neighborID);
+            pairs.insert(std::make_pair(std::min(ii, jj), std::max(ii, jj)));
+        }
+    }
+    index.neighborInds.resize(nRobots);
+    index.pairInds.resize(nRobots);
+    for (auto pair : pairs){
+        index.pairInds[pair.first].push_back(pair.second);
+        index.neighborInds[pair.first].push_back(pair.second);
+        index.neighborInds[pair.second].push_back(pair.first);
+    }
+    index.fiducialChecks.resize(nRobots);
+    for (int ii = 0; ii < nRobots; ii++){
+        auto robot = index.robots[ii];
+        for (auto fiducialID : robot->fiducialNeighbors){
+            auto fiducial = grid.fiducialDict.at(fiducialID);
+            double collideDist = robot->collisionBuffer + fiducial->collisionBuffer;
+            index.fiducialChecks[ii].push_back({fiducial->id, fiducial->xyzWok, collideDist*collideDist});
+        }
+    }
+    index.robotCollideDist = 2*grid.collisionBuffer + grid.maxDisplacement;
+    return index;
+}
+
+static bool segsCollide(const CollisionIndex & index, const std::array<vec3, 2> & seg1, const std::array<vec3, 2> & seg2){
+    // same test as RobotGrid::robotColliders
+    double dist2 = dist3D_Segment_to_Segment(seg2[0], seg2[1], seg1[0], seg1[1]);
+    return sqrt(dist2) < index.robotCollideDist;
+}
+
+static bool segCollidesFiducial(const FiducialCheck & fiducialCheck, const std::array<vec3, 2> & seg){
+    // same test as RobotGrid::fiducialColliders
+    double dist2 = dist3D_Point_to_Segment(fiducialCheck.xyzWok, seg[0], seg[1]);
+    return dist2 < fiducialCheck.collideDist2;
+}
+
+void RobotGrid::finishStreams(){
+    // keep every streamed path's final point once path gen is done
     for (auto rPair : robotDict){
-        auto r = rPair.second;
-        r->smoothVelocity(points);
+        if (rPair.second->streamPath){
+            rPair.second->finishStream();
+        }
     }
 }
 
+void RobotGrid::smoothPaths(int points, int nThreads){
+    // robots are smoothed independently, spread them over threads
+    std::vector<std::shared_ptr<Robot>> robots;
+    for (auto rPair : robotDict){
+        if (rPair.second->streamPath){
+            throw std::runtime_error("Cannot smooth, paths were simplified during path gen");
+        }
+        robots.push_back(rPair.second);
+    }
+    parallelFor(robots.size(), nThreads, [&](int ii){
+        robots[ii]->smoothVelocity(points);
+    });
+}
 
-void RobotGrid::simplifyPaths(){
+
+void RobotGrid::simplifyPaths(int nThreads){
+    // robots are simplified independently, spread them over threads.
+    // With clearanceSimplify every robot may stray from its rough path
+    // by half its clearance at each step (all of it from fiducials), so
+    // no two simplified paths can get closer than the collision
+    // distance if the rough paths didn't.  Any retiming of the old
+    // simplified paths is dropped
+    stepTimes.clear();
+    std::vector<std::shared_ptr<Robot>> robots;
     for (auto rPair : robotDict){
-        auto r = rPair.second;
-        r->simplifyPath(epsilon);
+        robots.push_back(rPair.second);
     }
+    if (robots.size() != 0 && robots[0]->streamPath){
+        // already simplified during path gen, just fill the dense paths
+        parallelFor(robots.size(), nThreads, [&](int ii){
+            auto robot = robots[ii];
+            robot->interpSimplifiedAlphaPath.clear();
+            robot->interpSimplifiedBetaPath.clear();
+            robot->interpAlphaX.clear();
+            robot->interpAlphaY.clear();
+            robot->interpBetaX.clear();
+            robot->interpBetaY.clear();
+            robot->interpolateSimplified();
+        });
+        return;
+    }
+    if (!clearanceSimplify){
+        parallelFor(robots.size(), nThreads, [&](int ii){
+            robots[ii]->simplifyPath(epsilon);
+        });
+        return;
+    }
+    auto maxDeviations = roughClearances(nThreads);
+    parallelFor(robots.size(), nThreads, [&](int ii){
+        robots[ii]->simplifyPathWithin(epsilon, maxDeviations[ii]);
+    });
 }
 
-void RobotGrid::verifySmoothed(){
+std::vector<std::vector<double>> RobotGrid::roughClearances(int nThreads){
+    // how far (mm) each robot's collision segment may move away from
+    // its rough path at each step without possibly colliding: half the
+    // margin to the closest neighbor (who may move toward it by the
+    // other half) or the whole margin to the closest fiducial.  Margins
+    // are over the collision distances used by verifySmoothed, robots
+    // already colliding get no slack.  Robots in robotDict order.
+    CollisionIndex index = collisionIndex(*this);
+    int nGridRobots = index.robots.size();
+    // a failed MDP path gen can count a step past the recorded paths,
+    // only steps every robot has are used (as in verifySmoothed)
+    int nPathSteps = nSteps;
+    for (auto robot : index.robots){
+        if (robot->streamPath){
+            throw std::runtime_error("Cannot compute clearances, paths were simplified during path gen");
+        }
+        if (nSteps > 0 && robot->alphaPath.size() == 0){
+            throw std::runtime_error("Cannot compute clearances, do path gen first");
+        }
+        nPathSteps = std::min(nPathSteps, (int)robot->alphaPath.size());
+        nPathSteps = std::min(nPathSteps, (int)robot->betaPath.size());
+    }
+    std::vector<std::vector<double>> clearances(
+        nGridRobots, std::vector<double>(nPathSteps, std::numeric_limits<double>::infinity())
+    );
+    const int blockSize = 64;
+    int nBlocks = (nPathSteps + blockSize - 1) / blockSize;
+    parallelFor(nBlocks, nThreads, [&](int block){
+        std::vector<std::array<vec3, 2>> segs(nGridRobots);
+        int lastStep = std::min(nPathSteps, (block+1)*blockSize);
+        for (int step = block*blockSize; step < lastStep; step++){
+            for (int ii = 0; ii < nGridRobots; ii++){
+                auto robot = index.robots[ii];
+                segs[ii] = robot->collisionSegAt(robot->alphaPath[step][1], robot->betaPath[step][1]);
+            }
+            for (int ii = 0; ii < nGridRobots; ii++){
+                for (auto jj : index.pairInds[ii]){
+                    double dist = sqrt(dist3D_Segment_to_Segment(
+                        segs[jj][0], segs[jj][1], segs[ii][0], segs[ii][1]
+                    ));
+                    double slack = 0.5*(dist - index.robotCollideDist);
+                    clearances[ii][step] = std::min(clearances[ii][step], slack);
+                    clearances[jj][step] = std::min(clearances[jj][step], slack);
+                }
+                for (auto & fiducialCheck : index.fiducialChecks[ii]){
+                    double dist = sqrt(dist3D_Point_to_Segment(
+                        fiducialCheck.xyzWok, segs[ii][0], segs[ii][1]
+                    ));
+                    double slack = dist - sqrt(fiducialCheck.collideDist2);
+                    clearances[ii][step] = std::min(clearances[ii][step], slack);
+                }
+                clearances[ii][step] = std::max(clearances[ii][step], 0.0);
+            }
+        }
+    });
+    return clearances;
+}
+
+void RobotGrid::verifySmoothed(int nThreads){
+    // count collisions along the interpolated simplified paths.  A
+    // failed MDP path gen can count a step past the recorded paths,
+    // only steps every robot has are checked
+    int nVerify = nSteps;
+    for (auto rPair : robotDict){
+        auto r = rPair.second;
+        if (nSteps > 0 && r->interpSimplifiedAlphaPath.size() == 0){
+            throw std::runtime_error("Cannot verify, simplify paths first");
+        }
+        nVerify = std::min(nVerify, (int)r->interpSimplifiedAlphaPath.size());
+        nVerify = std::min(nVerify, (int)r->interpSimplifiedBetaPath.size());
+    }
+    std::vector<int> robotIDs;
+    for (auto rPair : robotDict){
+        robotIDs.push_back(rPair.first);
+    }
+
+    // check a block of steps at a time, so long plans aren't copied
+    // into one nRobots x nSteps matrix
+    const int blockSteps = 512;
     smoothCollisions = 0;
-    for (int ii = 0; ii < nSteps; ii++){
+    for (int start = 0; start < nVerify; start += blockSteps){
+        int nBlock = std::min(blockSteps, nVerify - start);
+        Eigen::MatrixXd alphas(robotIDs.size(), nBlock);
+        Eigen::MatrixXd betas(robotIDs.size(), nBlock);
+        int row = 0;
         for (auto rPair : robotDict){
             auto r = rPair.second;
-            r->setAlphaBeta(r->interpSimplifiedAlphaPath[ii][1], r->interpSimplifiedBetaPath[ii][1]);
-            // std::cout << " robot id " << r.id << std::endl;
+            for (int ii = 0; ii < nBlock; ii++){
+                alphas(row, ii) = r->interpSimplifiedAlphaPath[start + ii][1];
+                betas(row, ii) = r->interpSimplifiedBetaPath[start + ii][1];
+            }
+            row++;
+        }
+        auto collisions = verifyTrajectories(robotIDs, alphas, betas, nThreads);
+        for (auto nCollide : std::get<0>(collisions)){
+            smoothCollisions += nCollide;
+        }
+    }
+
+    // leave robots at their last verified pose, as stepping through
+    // the paths used to
+    if (nVerify > 0){
+        for (auto rPair : robotDict){
+            auto r = rPair.second;
+            r->setAlphaBeta(
+                r->interpSimplifiedAlphaPath[nVerify-1][1],
+                r->interpSimplifiedBetaPath[nVerify-1][1]
+            );
         }
-        smoothCollisions += getNCollisions();
     }
     // std::cout << "interp collisions: " << nCollisions << std::endl;
 }
 
+std::tuple<std::vector<int>, std::vector<std::array<int, 3>>, std::vector<std::array<int, 3>>, int>
+RobotGrid::verifyTrajectories(
+    std::vector<int> robotIDs, const Eigen::MatrixXd & alphas,
+    const Eigen::MatrixXd & betas, int nThreads
+){
+    // collision check whole trajectories without changing any robot.
+    // Row ii of alphas/betas holds robotIDs[ii]'s alpha/beta at every
+    // step (column), robots not listed hold their current pose.  Blocks
+    // of steps are checked in parallel.  Returns the number of collided
+    // robots at each step (counted like getNCollisions), the colliding
+    // robot pairs and robot/fiducial pairs as [step, robotID, otherID],
+    // and the first collided step (-1 if none).
+    if (alphas.rows() != (int)robotIDs.size() || betas.rows() != alphas.rows() ||
+        betas.cols() != alphas.cols()){
+        throw std::runtime_error("alphas and betas must be nRobotIDs x nSteps");
+    }
+    int nTrajSteps = alphas.cols();
+
+    CollisionIndex index = collisionIndex(*this);
+    int nGridRobots = index.robots.size();
+    std::vector<int> trajRows(nGridRobots, -1);
+    for (int ii = 0; ii < (int)robotIDs.size(); ii++){
+        if (index.robotInds.count(robotIDs[ii]) == 0){
+            throw std::runtime_error("robotID not in grid");
+        }
+        int robotInd = index.robotInds[robotIDs[ii]];
+        if (trajRows[robotInd] != -1){
+            throw std::runtime_error("robotID given twice");
+        }
+        trajRows[robotInd] = ii;
+    }
+    std::vector<std::array<vec3, 2>> heldSegs(nGridRobots);
+    for (int ii = 0; ii < nGridRobots; ii++){
+        heldSegs[ii] = index.robots[ii]->collisionSegWokXYZ;
+    }
 
+    const int blockSize = 64;
+    int nBlocks = (nTrajSteps + blockSize - 1) / blockSize;
+    std::vector<int> stepCollisions(nTrajSteps, 0);
+    std::vector<std::vector<std::array<int, 3>>> blockRobotPairs(nBlocks);
+    std::vector<std::vector<std::array<int, 3>>> blockFiducialPairs(nBlocks);
+    parallelFor(nBlocks, nThreads, [&](int block){
+        std::vector<std::array<vec3, 2>> segs = heldSegs;
+        std::vector<bool> collided(nGridRobots);
+        int lastStep = std::min(nTrajSteps, (block+1)*blockSize);
+        for (int step = block*blockSize; step < lastStep; step++){
+            for (int ii = 0; ii < nGridRobots; ii++){
+                int row = trajRows[ii];
+                if (row != -1){
+                    segs[ii] = index.robots[ii]->collisionSegAt(alphas(row, step), betas(row, step));
+                }
+                collided[ii] = false;
+            }
+            for (int ii = 0; ii < nGridRobots; ii++){
+                for (auto jj : index.pairInds[ii]){
+                    if (segsCollide(index, segs[ii], segs[jj])){
+                        collided[ii] = true;
+                        collided[jj] = true;
+                        blockRobotPairs[block].push_back({step, index.robots[ii]->id, index.robots[jj]->id});
+                    }
+                }
+                for (auto & fiducialCheck : index.fiducialChecks[ii]){
+                    if (segCollidesFiducial(fiducialCheck, segs[ii])){
+                        collided[ii] = true;
+                        blockFiducialPairs[block].push_back({step, index.robots[ii]->id, fiducialCheck.id});
+                    }
+                }
+            }
+            stepCollisions[step] = std::count(collided.begin(), collided.end(), true);
+        }
+    });
+
+    std::vector<std::array<int, 3>> robotPairs, fiducialPairs;
+    for (int block = 0; block < nBlocks; block++){
+        robotPairs.insert(robotPairs.end(), blockRobotPairs[block].begin(), blockRobotPairs[block].end());
+        fiducialPairs.insert(fiducialPairs.end(), blockFiducialPairs[block].begin(), blockFiducialPairs[block].end());
+    }
+    int firstCollidedStep = -1;
+    for (int step = 0; step < nTrajSteps; step++){
+        if (stepCollisions[step] != 0){
+            firstCollidedStep = step;
+            break;
+        }
+    }
+    return std::make_tuple(stepCollisions, robotPairs, fiducialPairs, firstCollidedStep);
+}
+
+
+static void clearSmoothing(Robot & robot){
+    // drop everything smoothPaths/simplifyPaths appended to a robot
+    robot.alphaVel.clear();
+    robot.betaVel.clear();
+    robot.smoothAlphaVel.clear();
+    robot.smoothBetaVel.clear();
+    robot.smoothedAlphaPath.clear();
+    robot.smoothedBetaPath.clear();
+    robot.simplifiedAlphaPath.clear();
+    robot.simplifiedBetaPath.clear();
+    robot.interpSimplifiedAlphaPath.clear();
+    robot.interpSimplifiedBetaPath.clear();
+    robot.interpAlphaX.clear();
+    robot.interpAlphaY.clear();
+    robot.interpBetaX.clear();
+    robot.interpBetaY.clear();
+    robot.retimedAlphaPath.clear();
+    robot.retimedBetaPath.clear();
+}
+
+std::tuple<int, double> RobotGrid::tuneSimplification(
+    std::vector<int> smoothPoints, double minEpsilon, double maxEpsilon,
+    double tolerance, int nThreads
+){
+    // search the smoothing window and RDP epsilon giving the sparsest
+    // simplified paths with no smoothed collisions.  Every window in
+    // smoothPoints is tried and epsilon is bisected within [minEpsilon,
+    // maxEpsilon] down to tolerance.  The rough paths are reused, and
+    // an epsilon trial only rechecks robots at the steps where their
+    // interpolated pose differs from the last collision free trial
+    // (nothing else can have started colliding).  The grid is left
+    // smoothed, simplified and verified with the winning window and
+    // epsilon, which are returned.  If no trial is collision free the
+    // first window at minEpsilon is used, smoothCollisions reports it.
+    if (smoothPoints.size() == 0){
+        throw std::runtime_error("No smoothing windows to try");
+    }
+    if (minEpsilon < 0 || maxEpsilon < minEpsilon){
+        throw std::runtime_error("Need 0 <= minEpsilon <= maxEpsilon");
+    }
+    if (tolerance <= 0){
+        throw std::runtime_error("tolerance must be positive");
+    }
+    CollisionIndex index = collisionIndex(*this);
+    int nGridRobots = index.robots.size();
+    // a failed MDP path gen can count a step past the recorded paths,
+    // only steps every robot has are used (as in verifySmoothed)
+    int nPathSteps = nSteps;
+    for (auto robot : index.robots){
+        if (robot->streamPath){
+            throw std::runtime_error("Cannot tune, paths were simplified during path gen");
+        }
+        if (nSteps > 0 && robot->alphaPath.size() == 0){
+            throw std::runtime_error("Cannot tune, do path gen first");
+        }
+        nPathSteps = std::min(nPathSteps, (int)robot->alphaPath.size());
+        nPathSteps = std::min(nPathSteps, (int)robot->betaPath.size());
+    }
+
+    // interpolated simplified poses for one epsilon, as simplifyPath
+    // computes them, by robot index then step
+    struct Trial {
+        double epsilon;
+        long nSparse; // RDP points over all robots
+        std::vector<std::vector<double>> alphas, betas;
+    };
+    auto simplify = [&](double trialEpsilon, Trial & trial){
+        trial.epsilon = trialEpsilon;
+        trial.alphas.resize(nGridRobots);
+        trial.betas.resize(nGridRobots);
+        std::vector<long> nSparse(nGridRobots);
+        parallelFor(nGridRobots, nThreads, [&](int ii){
+            auto robot = index.robots[ii];
+            std::vector<vec2> sparseAlpha, sparseBeta;
+            std::vector<double> xVals(nPathSteps);
+            for (int step = 0; step < nPathSteps; step++){
+                xVals[step] = robot->alphaPath[step][0];
+            }
+            RamerDouglasPeucker(robot->smoothedAlphaPath, trialEpsilon, sparseAlpha);
+            RamerDouglasPeucker(robot->smoothedBetaPath, trialEpsilon, sparseBeta);
+            linearInterpolate(sparseAlpha, xVals, trial.alphas[ii]);
+            linearInterpolate(sparseBeta, xVals, trial.betas[ii]);
+            nSparse[ii] = sparseAlpha.size() + sparseBeta.size();
+        });
+        trial.nSparse = 0;
+        for (auto n : nSparse){
+            trial.nSparse += n;
+        }
+    };
+
+    // true if trial collides anywhere.  With a collision free baseline
+    // only robots whose pose changed at a step are checked there
+    auto collides = [&](Trial & trial, Trial * baseline){
+        std::vector<std::vector<int>> changedSteps(nPathSteps);
+        std::vector<std::vector<bool>> changed(nGridRobots, std::vector<bool>(nPathSteps, true));
+        for (int ii = 0; ii < nGridRobots; ii++){
+            for (int step = 0; step < nPathSteps; step++){
+                if (baseline != NULL &&
+                    trial.alphas[ii][step] == baseline->alphas[ii][step] &&
+                    trial.betas[ii][step] == baseline->betas[ii][step]){
+                    changed[ii][step] = false;
+                }
+                else {
+                    changedSteps[step].push_back(ii);
+                }
+            }
+        }
+        const int blockSize = 64;
+        int nBlocks = (nPathSteps + blockSize - 1) / blockSize;
+        std::atomic<bool> found(false);
+        parallelFor(nBlocks, nThreads, [&](int block){
+            std::vector<std::array<vec3, 2>> segs(nGridRobots);
+            std::vector<int> segStep(nGridRobots, -1);
+            auto seg = [&](int ii, int step) -> const std::array<vec3, 2> & {
+                if (segStep[ii] != step){
+                    segs[ii] = index.robots[ii]->collisionSegAt(trial.alphas[ii][step], trial.betas[ii][step]);
+                    segStep[ii] = step;
+                }
+                return segs[ii];
+            };
+            int lastStep = std::min(nPathSteps, (block+1)*blockSize);
+            for (int step = block*blockSize; step < lastStep && !found; step++){
+                for (auto ii : changedSteps[step]){
+                    for (auto jj : index.neighborInds[ii]){
+                        if (changed[jj][step] && jj < ii){
+                            continue; // checked from jj
+                        }
+                        if (segsCollide(index, seg(ii, step), seg(jj, step))){
+                            found = true;
+                        }
+                    }
+                    for (auto & fiducialCheck : index.fiducialChecks[ii]){
+                        if (segCollidesFiducial(fiducialCheck, seg(ii, step))){
+                            found = true;
+                        }
+                    }
+                }
+            }
+        });
+        return (bool)found;
+    };
+
+    int bestPoints = -1;
+    double bestEpsilon = minEpsilon;
+    long bestSparse = 0;
+    for (auto points : smoothPoints){
+        for (auto robot : index.robots){
+            clearSmoothing(*robot);
+        }
+        smoothPaths(points, nThreads);
+
+        Trial baseline, trial;
+        simplify(minEpsilon, baseline);
+        if (collides(baseline, NULL)){
+            continue;
+        }
+        // try the most aggressive epsilon first, then bisect
+        simplify(maxEpsilon, trial);
+        if (!collides(trial, &baseline)){
+            std::swap(baseline, trial);
+        }
+        else {
+            double hi = maxEpsilon;
+            while (hi - baseline.epsilon > tolerance){
+                simplify(0.5*(baseline.epsilon + hi), trial);
+                if (collides(trial, &baseline)){
+                    hi = trial.epsilon;
+                }
+                else {
+                    std::swap(baseline, trial);
+                }
+            }
+        }
+        if (bestPoints == -1 || baseline.nSparse < bestSparse){
+            bestPoints = points;
+            bestEpsilon = baseline.epsilon;
+            bestSparse = baseline.nSparse;
+        }
+    }
+
+    // redo the pipeline for the winner so robots carry its paths
+    if (bestPoints == -1){
+        bestPoints = smoothPoints[0];
+        bestEpsilon = minEpsilon;
+    }
+    epsilon = bestEpsilon;
+    for (auto robot : index.robots){
+        clearSmoothing(*robot);
+    }
+    smoothPaths(bestPoints, nThreads);
+    simplifyPaths(nThreads);
+    verifySmoothed(nThreads);
+    return std::make_tuple(bestPoints, bestEpsilon);
+}
+
+double RobotGrid::retimePaths(
+    double maxAlphaSpeed, double maxBetaSpeed,
+    double maxAlphaAccel, double maxBetaAccel
+){
+    // retime the simplified paths for the shortest total move under per
+    // axis speed (deg/s) and acceleration (deg/s^2) limits, starting
+    // and ending at rest.  All robots share one warp of the step clock,
+    // so at any time the grid is in a configuration the step clock also
+    // passes through and every clearance along the step clock holds.
+    // The warp gives each step interval a rate (steps/s), capped by
+    // speed, then chosen so every robot's change of speed on each axis
+    // between neighboring intervals respects its acceleration limit.
+    // Fills stepTimes and every robot's retimedAlphaPath/BetaPath,
+    // returns the move time.
+    if (maxAlphaSpeed <= 0 || maxBetaSpeed <= 0 || maxAlphaAccel <= 0 || maxBetaAccel <= 0){
+        throw std::runtime_error("Speed and acceleration limits must be positive");
+    }
+    std::vector<std::shared_ptr<Robot>> robots;
+    double lastX = 0;
+    for (auto rPair : robotDict){
+        auto robot = rPair.second;
+        if (robot->simplifiedAlphaPath.size() == 0 || robot->simplifiedBetaPath.size() == 0){
+            throw std::runtime_error("Cannot retime, simplify paths first");
+        }
+        lastX = std::max(lastX, robot->simplifiedAlphaPath.back()[0]);
+        lastX = std::max(lastX, robot->simplifiedBetaPath.back()[0]);
+        robots.push_back(robot);
+    }
+    int nRobots = robots.size();
+
+    // poses at every step until the last simplified point
+    int nDense = (int)ceil(lastX) + 1;
+    std::vector<double> xVals(nDense);
+    for (int step = 0; step < nDense; step++){
+        xVals[step] = step;
+    }
+    std::vector<std::vector<double>> alphas(nRobots), betas(nRobots);
+    for (int ii = 0; ii < nRobots; ii++){
+        linearInterpolate(robots[ii]->simplifiedAlphaPath, xVals, alphas[ii]);
+        linearInterpolate(robots[ii]->simplifiedBetaPath, xVals, betas[ii]);
+    }
+
+    // step intervals where anything moves, nothing else takes time
+    std::vector<int> moving;
+    for (int step = 0; step < nDense-1; step++){
+        for (int ii = 0; ii < nRobots; ii++){
+            if (alphas[ii][step+1] != alphas[ii][step] || betas[ii][step+1] != betas[ii][step]){
+                moving.push_back(step);
+                break;
+            }
+        }
+    }
+    int nMoving = moving.size();
+
+    // the rate (steps/s) of each moving interval is capped by the
+    // fastest robot's speed.  Speeds are taken at interval midpoints, so
+    // a robot moving d (deg/step) at rate x then e at rate y changes
+    // speed by |e*y - d*x| over (1/x + 1/y)/2 seconds.  That change is at
+    // most |faster interval's move|*|y - x| (the rate change) plus
+    // |e - d|*min(x, y) (the path's corner taken at the slower rate), and
+    // each is held to half of accel*(1/x + 1/y)/2:
+    //   rate change: faster <= (slower + sqrt(slower^2 + 2*rateAccel))/2,
+    //     rateAccel = accel/move of the faster interval's biggest mover
+    //   corner: min(x, y) <= sqrt(accel/(2*|e - d|)) over all robots
+    // Leaving rest or stopping in the first or last half interval caps
+    // their rates at sqrt(rateAccel/2).  A forward pass limits speeding
+    // up and a backward pass slowing down, the corner cap goes on
+    // whichever side of a corner is slower
+    std::vector<double> maxRates(nMoving), rateAccels(nMoving);
+    std::vector<double> cornerRates(std::max(nMoving-1, 0), std::numeric_limits<double>::infinity());
+    for (int mm = 0; mm < nMoving; mm++){
+        double maxDAlpha = 0;
+        double maxDBeta = 0;
+        for (int ii = 0; ii < nRobots; ii++){
+            int step = moving[mm];
+            double dAlpha = alphas[ii][step+1] - alphas[ii][step];
+            double dBeta = betas[ii][step+1] - betas[ii][step];
+            maxDAlpha = std::max(maxDAlpha, fabs(dAlpha));
+            maxDBeta = std::max(maxDBeta, fabs(dBeta));
+            if (mm + 1 < nMoving){
+                int next = moving[mm+1];
+                double cornerAlpha = fabs(alphas[ii][next+1] - alphas[ii][next] - dAlpha);
+                double cornerBeta = fabs(betas[ii][next+1] - betas[ii][next] - dBeta);
+                if (cornerAlpha > 0){
+                    cornerRates[mm] = std::min(cornerRates[mm], sqrt(maxAlphaAccel / (2*cornerAlpha)));
+                }
+                if (cornerBeta > 0){
+                    cornerRates[mm] = std::min(cornerRates[mm], sqrt(maxBetaAccel / (2*cornerBeta)));
+                }
+            }
+        }
+        maxRates[mm] = std::min(maxAlphaSpeed / maxDAlpha, maxBetaSpeed / maxDBeta);
+        rateAccels[mm] = std::min(maxAlphaAccel / maxDAlpha, maxBetaAccel / maxDBeta);
+    }
+    auto fasterLimit = [&](double slower, int mm){
+        // fastest rate for interval mm next to one at rate slower
+        return 0.5*(slower + sqrt(slower*slower + 2*rateAccels[mm]));
+    };
+    std::vector<double> rates(nMoving);
+    for (int mm = 0; mm < nMoving; mm++){
+        if (mm == 0){
+            rates[mm] = std::min(maxRates[mm], sqrt(0.5*rateAccels[mm]));
+            continue;
+        }
+        rates[mm] = std::min(maxRates[mm], fasterLimit(rates[mm-1], mm));
+        if (rates[mm-1] > cornerRates[mm-1]){
+            rates[mm] = std::min(rates[mm], cornerRates[mm-1]);
+        }
+    }
+    for (int mm = nMoving-1; mm >= 0; mm--){
+        if (mm == nMoving-1){
+            rates[mm] = std::min(rates[mm], sqrt(0.5*rateAccels[mm]));
+            continue;
+        }
+        rates[mm] = std::min(rates[mm], fasterLimit(rates[mm+1], mm));
+        if (rates[mm+1] > cornerRates[mm]){
+            rates[mm] = std::min(rates[mm], cornerRates[mm]);
+        }
+    }
+
+    stepTimes.assign(nDense, 0);
+    std::vector<double> intervalTimes(nDense, 0);
+    for (int mm = 0; mm < nMoving; mm++){
+        intervalTimes[moving[mm]] = 1 / rates[mm];
+    }
+    for (int step = 1; step < nDense; step++){
+        stepTimes[step] = stepTimes[step-1] + intervalTimes[step-1];
+    }
+
+    // each robot's path in time only bends where its speed changes
+    auto retime = [&](std::vector<double> & angles, std::vector<vec2> & retimed){
+        retimed.clear();
+        retimed.push_back({stepTimes[0], angles[0]});
+        double lastSpeed = 0;
+        for (auto step : moving){
+            double speed = (angles[step+1] - angles[step]) / intervalTimes[step];
+            if (fabs(speed - lastSpeed) > 1e-9 && retimed.back()[0] != stepTimes[step]){
+                retimed.push_back({stepTimes[step], angles[step]});
+            }
+            lastSpeed = speed;
+        }
+        if (retimed.back()[0] != stepTimes.back()){
+            retimed.push_back({stepTimes.back(), angles.back()});
+        }
+    };
+    for (int ii = 0; ii < nRobots; ii++){
+        retime(alphas[ii], robots[ii]->retimedAlphaPath);
+        retime(betas[ii], robots[ii]->retimedBetaPath);
+    }
+    return stepTimes.back();
+}
+
+int RobotGrid::shortcutPaths(int nIterations, int nThreads){
+    // shorten the rough paths by repeatedly replacing a random stretch
+    // of a random robot's path with a direct move between its ends:
+    // each axis heads straight for its end pose at angStep per step
+    // and waits there (like the planners move, so RDP finds few
+    // corners).  A shortcut is kept only if it travels less and never
+    // collides with the neighbors (as they move along their current
+    // paths) or a fiducial.  Run before smoothing, returns the number
+    // of shortcuts taken.
+    CollisionIndex index = collisionIndex(*this);
+    int nGridRobots = index.robots.size();
+    if (nGridRobots == 0){
+        return 0;
+    }
+    int nPathSteps = index.robots[0]->alphaPath.size();
+    for (auto robot : index.robots){
+        if (robot->streamPath){
+            throw std::runtime_error("Cannot shortcut, paths were simplified during path gen");
+        }
+        if ((int)robot->alphaPath.size() != nPathSteps || nPathSteps == 0){
+            throw std::runtime_error("Cannot shortcut, do path gen first");
+        }
+    }
+    if (nPathSteps < 3){
+        return 0;
+    }
+
+    // collision segments along everyone's path, kept up to date
+    std::vector<std::vector<std::array<vec3, 2>>> pathSegs(nGridRobots);
+    parallelFor(nGridRobots, nThreads, [&](int ii){
+        auto robot = index.robots[ii];
+        pathSegs[ii].resize(nPathSteps);
+        for (int step = 0; step < nPathSteps; step++){
+            pathSegs[ii][step] = robot->collisionSegAt(robot->alphaPath[step][1], robot->betaPath[step][1]);
+        }
+    });
+
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> pickRobot(0, nGridRobots-1);
+    std::vector<std::array<vec3, 2>> newSegs;
+    std::vector<vec2> newPoses;
+    int nShortcuts = 0;
+    for (int iter = 0; iter < nIterations; iter++){
+        int ii = pickRobot(rng);
+        int start = std::uniform_int_distribution<int>(0, nPathSteps-3)(rng);
+        int end = std::uniform_int_distribution<int>(start+2, nPathSteps-1)(rng);
+        auto robot = index.robots[ii];
+        auto & alphaPath = robot->alphaPath;
+        auto & betaPath = robot->betaPath;
+
+        double pathLength = 0;
+        for (int step = start; step < end; step++){
+            double dAlpha = alphaPath[step+1][1] - alphaPath[step][1];
+            double dBeta = betaPath[step+1][1] - betaPath[step][1];
+            pathLength += fabs(dAlpha) + fabs(dBeta);
+        }
+        double dAlpha = alphaPath[end][1] - alphaPath[start][1];
+        double dBeta = betaPath[end][1] - betaPath[start][1];
+        if (fabs(dAlpha) + fabs(dBeta) >= pathLength - 1e-9){
+            continue; // already direct
+        }
+        // multi step moves may have covered more than angStep a step
+        double speed = std::max(angStep, std::max(fabs(dAlpha), fabs(dBeta)) / (end - start));
+
+        newPoses.clear();
+        newSegs.clear();
+        bool collided = false;
+        for (int step = start+1; step < end && !collided; step++){
+            double moved = (step - start)*speed;
+            vec2 pose = {
+                alphaPath[start][1] + copysign(std::min(fabs(dAlpha), moved), dAlpha),
+                betaPath[start][1] + copysign(std::min(fabs(dBeta), moved), dBeta)
+            };
+            auto seg = robot->collisionSegAt(pose[0], pose[1]);
+            for (auto jj : index.neighborInds[ii]){
+                if (segsCollide(index, seg, pathSegs[jj][step])){
+                    collided = true;
+                    break;
+                }
+            }
+            for (auto & fiducialCheck : index.fiducialChecks[ii]){
+                if (segCollidesFiducial(fiducialCheck, seg)){
+                    collided = true;
+                    break;
+                }
+            }
+            newPoses.push_back(pose);
+            newSegs.push_back(seg);
+        }
+        if (collided){
+            continue;
+        }
+
+        for (int step = start+1; step < end; step++){
+            auto & pose = newPoses[step-start-1];
+            auto & seg = newSegs[step-start-1];
+            alphaPath[step][1] = pose[0];
+            betaPath[step][1] = pose[1];
+            pathSegs[ii][step] = seg;
+            robot->roughAlphaX[step][1] = seg[0][0];
+            robot->roughAlphaY[step][1] = seg[0][1];
+            robot->roughBetaX[step][1] = seg.back()[0];
+            robot->roughBetaY[step][1] = seg.back()[1];
+        }
+        nShortcuts++;
+    }
+    return nShortcuts;
+}
 
 int RobotGrid::getNCollisions(){
     // return number of collisions found
@@ -267,11 +1284,127 @@ void RobotGrid::clearPaths(){
         r->roughBetaX.clear();
         r->roughBetaY.clear();
         r->scoreVec.clear();
+        r->retimedAlphaPath.clear();
+        r->retimedBetaPath.clear();
+        r->streamPath = false;
+        r->clearUntilStep = -1;
         // r->onTargetVec.clear();
     }
+    stepTimes.clear();
+    nSkippedChecks = 0;
 
 }
 
+void RobotGrid::buildCostField(int robotID){
+    // wavefront (breadth first search) over the robot's alpha/beta lattice
+    // outward from its destination.  Lattice nodes that collide with a
+    // fiducial are obstacles, so the cost to go steers around fiducials
+    // where the squared angular distance of the plain score would trap
+    // the robot.  Fiducials never move so the obstacle map is only
+    // computed once, and the field is reused until the destination changes
+    auto robot = robotDict[robotID];
+    if (!robot->hasDestinationAlphaBeta){
+        throw std::runtime_error("Cannot build cost field, robot has no destination alpha/beta");
+    }
+    if (robot->fiducialNeighbors.size() == 0){
+        // nothing to steer around, the plain score does the job
+        robot->useCostField = false;
+        return;
+    }
+
+    double step = costFieldStep;
+    int nAlpha = (int)floor(360.0/step) + 1;
+    int nBeta = (int)floor(180.0/step) + 1;
+    int nNodes = nAlpha*nBeta;
+    if (robot->costFieldStep != step or (int)robot->costFieldBlocked.size() != nNodes){
+        robot->costFieldStep = step;
+        robot->costFieldNAlpha = nAlpha;
+        robot->costFieldNBeta = nBeta;
+        robot->costField.clear();
+        robot->costFieldBlocked.assign(nNodes, false);
+        double savedAlpha = robot->alpha;
+        double savedBeta = robot->beta;
+        for (int ia=0; ia<nAlpha; ia++){
+            for (int ib=0; ib<nBeta; ib++){
+                robot->setAlphaBeta(ia*step, ib*step);
+                if (fiducialColliders(robotID).size() != 0){
+                    robot->costFieldBlocked[ia*nBeta + ib] = true;
+                }
+            }
+        }
+        robot->setAlphaBeta(savedAlpha, savedBeta);
+    }
+
+    if ((int)robot->costField.size() == nNodes and
+        robot->costFieldAlpha == robot->destinationAlpha and
+        robot->costFieldBeta == robot->destinationBeta){
+        // field for this destination is cached
+        robot->useCostField = true;
+        return;
+    }
+
+    // seed the wavefront from the corners of the lattice cell containing
+    // the destination, with their (fractional) distance in steps
+    double destAlpha = robot->destinationAlpha;
+    double destBeta = robot->destinationBeta;
+    int ia0 = std::min(std::max((int)floor(destAlpha/step), 0), nAlpha - 2);
+    int ib0 = std::min(std::max((int)floor(destBeta/step), 0), nBeta - 2);
+    std::vector<std::pair<double, int>> seeds;
+    for (int ia=ia0; ia<ia0+2; ia++){
+        for (int ib=ib0; ib<ib0+2; ib++){
+            if (robot->costFieldBlocked[ia*nBeta + ib]){
+                continue;
+            }
+            double dist = std::max(std::abs(ia*step - destAlpha), std::abs(ib*step - destBeta));
+            seeds.push_back({dist/step, ia*nBeta + ib});
+        }
+    }
+    if (seeds.size() == 0){
+        // destination is walled in by fiducials, field is no help
+        robot->costField.clear();
+        robot->useCostField = false;
+        return;
+    }
+
+    // seeds are all within one step of each other, so a fifo queue
+    // visited in sorted seed order labels every node with its minimum cost
+    std::sort(seeds.begin(), seeds.end());
+    float unreachable = (float)nNodes;
+    std::vector<float> & field = robot->costField;
+    field.assign(nNodes, unreachable);
+    std::deque<int> queue;
+    for (auto seed : seeds){
+        field[seed.second] = seed.first;
+        queue.push_back(seed.second);
+    }
+    while (queue.size() != 0){
+        int node = queue.front();
+        queue.pop_front();
+        int ia = node / nBeta;
+        int ib = node % nBeta;
+        // moves of one step on either or both axes, like perturbArray
+        for (int da=-1; da<2; da++){
+            for (int db=-1; db<2; db++){
+                int na = ia + da;
+                int nb = ib + db;
+                if (na < 0 or na >= nAlpha or nb < 0 or nb >= nBeta){
+                    continue;
+                }
+                int next = na*nBeta + nb;
+                if (field[next] != unreachable or robot->costFieldBlocked[next]){
+                    continue;
+                }
+                field[next] = field[node] + 1;
+                queue.push_back(next);
+            }
+        }
+    }
+
+    robot->costFieldAlpha = destAlpha;
+    robot->costFieldBeta = destBeta;
+    robot->useCostField = true;
+}
+
 void RobotGrid::pathGenMDP(double setGreed, double setPhobia){
     // path gen 2 steps towards alpha beta target
     // move greed and phobia to constructor?
@@ -279,6 +1412,19 @@ void RobotGrid::pathGenMDP(double setGreed, double setPhobia){
     phobia = setPhobia;
     algType = MDP;
     clearPaths();
+    for (auto rPair : robotDict){
+        if (useCostFields){
+            buildCostField(rPair.first);
+        }
+        else {
+            rPair.second->useCostField = false;
+        }
+    }
+    if (streamSimplify){
+        for (auto rPair : robotDict){
+            rPair.second->startStream(epsilon);
+        }
+    }
     didFail = true;
     int ii;
     std::vector<int> robotIDs;
@@ -295,7 +1441,9 @@ void RobotGrid::pathGenMDP(double setGreed, double setPhobia){
             // std::cout << "path gen " << r.betaOrientation.size() << " " << r.betaModel.size() << std::endl;
             // std::cout << "alpha beta " << r.alpha << " " << r.beta << std::endl;
             stepMDP(r, ii);
-            r->scoreVec.push_back(r->score());
+            if (!r->streamPath){
+                r->scoreVec.push_back(r->score());
+            }
             if (r->score()!=0) {
                 // could just check the last elemet in onTargetVec? same thing.
                 // or use robot->score
@@ -303,49 +1451,698 @@ void RobotGrid::pathGenMDP(double setGreed, double setPhobia){
             }
         }
 
-        if (allAtTarget){
-            // std::cout << "all at target" << std::endl;
-            didFail = false;
-            break;
+        if (allAtTarget){
+            // std::cout << "all at target" << std::endl;
+            didFail = false;
+            break;
+        }
+    }
+
+    nSteps = ii+1;
+    finishStreams();
+}
+
+void RobotGrid::pathGenGreedy(){
+    // path gen 2 steps towards alpha beta target
+    // if maxStepMultiplier > 1, robots with enough clearance may
+    // move up to maxStepMultiplier steps per sweep of the grid
+    clearPaths();
+    for (auto rPair : robotDict){
+        if (useCostFields){
+            buildCostField(rPair.first);
+        }
+        else {
+            rPair.second->useCostField = false;
+        }
+    }
+    if (streamSimplify){
+        for (auto rPair : robotDict){
+            rPair.second->startStream(epsilon);
+        }
+    }
+    didFail = true;
+    greed = 1;
+    phobia = 0;
+    algType = Greedy;
+    nSweeps = 0;
+    nStepCalls = 0;
+    nMultiSteps = 0;
+    int ii = 0;
+    while (ii < maxPathSteps){
+        int nSub = 1;
+        std::vector<std::shared_ptr<Robot>> steppers;
+        if (maxStepMultiplier > 1){
+            nSub = std::min(maxStepMultiplier, maxPathSteps - ii);
+        }
+        for (auto rPair : robotDict){
+            auto r = rPair.second;
+            if (nSub > 1 and r->score() != 0){
+                // a robot is free to move nSub steps at once if it
+                // can't reach anything even if all its neighbors
+                // move nSub steps towards it
+                r->clearance = clearance(r->id);
+                if (r->clearance > nSub*maxDisplacement){
+                    stepGreedyMulti(r, ii, nSub);
+                    nStepCalls++;
+                    nMultiSteps++;
+                    continue;
+                }
+            }
+            steppers.push_back(r);
+        }
+
+        // everyone else moves a single step at a time
+        for (int jj=0; jj<nSub; jj++){
+            for (auto r : steppers){
+                // std::cout << "path gen " << r.betaOrientation.size() << " " << r.betaModel.size() << std::endl;
+                // std::cout << "alpha beta " << r.alpha << " " << r.beta << std::endl;
+                stepGreedy(r, ii+jj);
+                if (!r->streamPath){
+                    r->scoreVec.push_back(r->score());
+                }
+            }
+        }
+        nStepCalls += nSub*steppers.size();
+        nSweeps++;
+        ii += nSub;
+
+        bool allAtTarget = true;
+        for (auto rPair : robotDict){
+            if (rPair.second->score()!=0) {
+                allAtTarget = false;
+                break;
+            }
+        }
+
+        if (allAtTarget){
+            // std::cout << "all at target" << std::endl;
+            didFail = false;
+            break;
+        }
+    }
+
+    nSteps = ii;
+    finishStreams();
+}
+
+void RobotGrid::pathGenTiled(double tileSize, int nThreads){
+    // greedy path gen with each sweep split over square tiles of the
+    // focal plane.  Tiles are colored by the parity of their column and
+    // row, tiles of one color are at least a tile apart, so when tiles
+    // are wider than the neighbor distance no robot in one has a
+    // neighbor in another.  Every sweep steps each color's tiles in
+    // parallel (robots within a tile in order), then the next color,
+    // so every robot sees its neighbors' current poses as in
+    // pathGenGreedy and takes one step per sweep.  Tiles keep their
+    // own perturbations and random generator, so the plan doesn't
+    // depend on nThreads.
+    if (tileSize <= 0){
+        throw std::runtime_error("tileSize must be positive");
+    }
+    if (maxStepMultiplier > 1){
+        throw std::runtime_error("pathGenTiled takes single steps, set maxStepMultiplier to 1");
+    }
+    for (auto rPair : robotDict){
+        auto robot = rPair.second;
+        for (auto otherRobotID : robot->robotNeighbors){
+            auto robot2 = robotDict.at(otherRobotID);
+            double dx = robot->basePos[0] - robot2->basePos[0];
+            double dy = robot->basePos[1] - robot2->basePos[1];
+            if (std::max(fabs(dx), fabs(dy)) >= tileSize){
+                throw std::runtime_error("tileSize must exceed the distance between neighboring robots");
+            }
+        }
+    }
+    clearPaths();
+    for (auto rPair : robotDict){
+        if (useCostFields){
+            buildCostField(rPair.first);
+        }
+        else {
+            rPair.second->useCostField = false;
+        }
+    }
+    if (streamSimplify){
+        for (auto rPair : robotDict){
+            rPair.second->startStream(epsilon);
+        }
+    }
+    didFail = true;
+    greed = 1;
+    phobia = 0;
+    algType = Greedy;
+    nStepCalls = 0;
+    nMultiSteps = 0;
+
+    // assign robots to tiles by base position
+    std::map<std::pair<int, int>, int> tileIndex;
+    std::vector<std::vector<std::shared_ptr<Robot>>> tileRobots;
+    std::vector<std::vector<int>> colorTiles(4);
+    for (auto rPair : robotDict){
+        auto robot = rPair.second;
+        std::pair<int, int> tileXY = {
+            (int)floor(robot->basePos[0]/tileSize), (int)floor(robot->basePos[1]/tileSize)
+        };
+        if (tileIndex.count(tileXY) == 0){
+            int nTiles = tileIndex.size();
+            tileIndex[tileXY] = nTiles;
+            tileRobots.emplace_back();
+            colorTiles[(tileXY.first & 1) + 2*(tileXY.second & 1)].push_back(nTiles);
+        }
+        tileRobots[tileIndex[tileXY]].push_back(robot);
+    }
+    int nTiles = tileRobots.size();
+    std::vector<std::vector<vec2>> tilePerturbations(nTiles, perturbArray);
+    std::vector<std::mt19937> tileRngs;
+    for (int tile = 0; tile < nTiles; tile++){
+        tileRngs.emplace_back(seed + tile);
+    }
+    std::vector<long> tileSkipped(nTiles, 0);
+
+    int ii;
+    for (ii=0; ii<maxPathSteps; ii++){
+        for (auto & tiles : colorTiles){
+            parallelFor(tiles.size(), nThreads, [&](int jj){
+                int tile = tiles[jj];
+                for (auto r : tileRobots[tile]){
+                    stepGreedy(r, ii, tilePerturbations[tile], &tileRngs[tile], tileSkipped[tile]);
+                    if (!r->streamPath){
+                        r->scoreVec.push_back(r->score());
+                    }
+                }
+            });
+        }
+        nStepCalls += robotDict.size();
+
+        bool allAtTarget = true;
+        for (auto rPair : robotDict){
+            if (rPair.second->score() != 0){
+                allAtTarget = false;
+                break;
+            }
+        }
+        if (allAtTarget){
+            ii++;
+            didFail = false;
+            break;
+        }
+    }
+    for (auto nSkipped : tileSkipped){
+        nSkippedChecks += nSkipped;
+    }
+    nSteps = ii;
+    nSweeps = ii;
+    finishStreams();
+}
+
+void RobotGrid::stepGreedyMulti(std::shared_ptr<Robot> robot, int stepNum, int nSub){
+    // take a single greedy move of up to nSub*angStep on each axis,
+    // and record it as nSub consecutive steps of at most angStep each
+    // so the path stays on the common step timeline.  No collision
+    // checking is done here, the caller must ensure the robot's
+    // clearance exceeds nSub*maxDisplacement
+    double score;
+    double currAlpha = robot->alpha;
+    double currBeta = robot->beta;
+    double bestAlpha, bestBeta, nextAlpha, nextBeta;
+    double bestScore = 1e16; // to be minimized
+    bestAlpha = currAlpha;
+    bestBeta = currBeta;
+
+    std::random_shuffle(perturbArray.begin(), perturbArray.end());
+    for (auto dAlphaBeta : perturbArray){
+        nextAlpha = currAlpha + nSub*dAlphaBeta[0];
+        nextBeta = currBeta + nSub*dAlphaBeta[1];
+        // careful not to overshoot
+        if (currAlpha > robot->destinationAlpha and nextAlpha <= robot->destinationAlpha){
+            nextAlpha = robot->destinationAlpha;
+        }
+        if (currAlpha < robot->destinationAlpha and nextAlpha >= robot->destinationAlpha){
+            nextAlpha = robot->destinationAlpha;
+        }
+        if (currBeta > robot->destinationBeta and nextBeta <= robot->destinationBeta){
+            nextBeta = robot->destinationBeta;
+        }
+        if (currBeta < robot->destinationBeta and nextBeta >= robot->destinationBeta){
+            nextBeta = robot->destinationBeta;
+        }
+        // handle limits of travel
+        nextAlpha = std::min(std::max(nextAlpha, 0.0), 360.0);
+        nextBeta = std::min(std::max(nextBeta, 0.0), 180.0);
+
+        robot->setAlphaBeta(nextAlpha, nextBeta);
+        score = robot->score();
+        if (score < bestScore){
+            bestScore = score;
+            bestAlpha = nextAlpha;
+            bestBeta = nextBeta;
+        }
+        else if (score == bestScore and randomSample() >= 0.5){
+            // flip a coin to see whether to accept
+            bestScore = score;
+            bestAlpha = nextAlpha;
+            bestBeta = nextBeta;
+        }
+    }
+
+    // walk each axis towards the chosen point one angStep at a time
+    double dAlpha = bestAlpha - currAlpha;
+    double dBeta = bestBeta - currBeta;
+    for (int jj=1; jj<=nSub; jj++){
+        nextAlpha = bestAlpha;
+        nextBeta = bestBeta;
+        if (std::abs(dAlpha) > jj*angStep){
+            nextAlpha = currAlpha + std::copysign(jj*angStep, dAlpha);
+        }
+        if (std::abs(dBeta) > jj*angStep){
+            nextBeta = currBeta + std::copysign(jj*angStep, dBeta);
+        }
+        if (robot->score() != 0){
+            robot->lastStepNum = stepNum + jj - 1;
+        }
+        robot->setAlphaBeta(nextAlpha, nextBeta);
+        robot->addPathPoint(stepNum + jj - 1);
+        if (!robot->streamPath){
+            robot->scoreVec.push_back(robot->score());
+        }
+    }
+}
+
+// Local solver for small deadlocked clusters.  Robots in the cluster
+// are planned one at a time with a space-time A* over the angStep
+// lattice (steps from perturbArray, same overshoot handling as
+// stepGreedy).  Fiducials and robots outside the cluster are fixed
+// obstacles, cluster robots already planned are moving obstacles.
+// If some robot can't be planned the cluster is retried with a new
+// planning order.
+
+// lattice poses are hashed at 1e-4 degree resolution, alpha major
+static long long clusterPoseKey(double alpha, double beta){
+    return llround(alpha*1e4)*2000001LL + llround(beta*1e4);
+}
+
+struct ClusterPose {
+    bool frozenCollided; // collides with a fiducial or robot outside the cluster
+    std::array<vec3, 2> collisionSeg;
+};
+
+struct ClusterObstacle {
+    // the planned path of another cluster robot, as collision segments
+    // by step.  The robot is parked at the last one from then on
+    std::vector<std::array<vec3, 2>> collisionSegs;
+    double minDist2; // squared distance to keep
+};
+
+struct ClusterSearchNode {
+    double alpha;
+    double beta;
+    int stepNum;
+    int parent;
+};
+
+struct ClusterAgent {
+    std::shared_ptr<Robot> robot;
+    vec2 start;
+    // squared distance to keep from each fiducial and robot outside the
+    // cluster.  The collision distance, unless the robot starts out
+    // closer, in which case it may not get any closer
+    std::map<int, double> fiducialMinDist2;
+    std::map<int, double> robotMinDist2;
+    std::map<long long, ClusterPose> poseCache;
+    std::vector<vec2> path;
+};
+
+static ClusterPose & clusterPose(RobotGrid & grid, ClusterAgent & agent, vec2 pose){
+    // look up (or compute) a cluster robot's collision segment at a pose
+    // and whether it collides there with fiducials or with robots outside
+    // the cluster, which hold their current poses
+    long long key = clusterPoseKey(pose[0], pose[1]);
+    auto cached = agent.poseCache.find(key);
+    if (cached != agent.poseCache.end()){
+        return cached->second;
+    }
+    auto robot = agent.robot;
+    ClusterPose & clusterPose = agent.poseCache[key];
+    robot->setAlphaBeta(pose[0], pose[1]);
+    clusterPose.collisionSeg = {robot->collisionSegWokXYZ[0], robot->collisionSegWokXYZ.back()};
+    clusterPose.frozenCollided = false;
+    for (auto fPair : agent.fiducialMinDist2){
+        double dist2 = dist3D_Point_to_Segment(
+                grid.fiducialDict[fPair.first]->xyzWok,
+                robot->collisionSegWokXYZ[0], robot->collisionSegWokXYZ[1]
+            );
+        if (dist2 < fPair.second){
+            clusterPose.frozenCollided = true;
+            return clusterPose;
+        }
+    }
+    for (auto rPair : agent.robotMinDist2){
+        auto robot2 = grid.robotDict[rPair.first];
+        double dist2 = dist3D_Segment_to_Segment(
+                robot2->collisionSegWokXYZ[0], robot2->collisionSegWokXYZ[1],
+                robot->collisionSegWokXYZ[0], robot->collisionSegWokXYZ[1]
+            );
+        if (dist2 < rPair.second){
+            clusterPose.frozenCollided = true;
+            return clusterPose;
+        }
+    }
+    return clusterPose;
+}
+
+static bool clusterCollided(const ClusterPose & pose, int stepNum, const std::vector<ClusterObstacle> & obstacles){
+    // does a pose collide with any planned cluster robot at this step
+    for (auto & obstacle : obstacles){
+        int ind = std::min(stepNum, (int)obstacle.collisionSegs.size() - 1);
+        double dist2 = dist3D_Segment_to_Segment(
+                pose.collisionSeg[0], pose.collisionSeg[1],
+                obstacle.collisionSegs[ind][0], obstacle.collisionSegs[ind][1]
+            );
+        if (dist2 < obstacle.minDist2){
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool clusterPlanRobot(
+    RobotGrid & grid, ClusterAgent & agent,
+    const std::vector<ClusterObstacle> & obstacles, int maxExpansions,
+    long & nTotalExpanded
+){
+    // space-time A* from the agent's start to its destination, one step
+    // (or wait) per path step, into agent.path.  Returns false if no path
+    // was found within maxExpansions node expansions or maxPathSteps steps.
+    // Expansions are added to nTotalExpanded.
+    auto robot = agent.robot;
+    vec2 start = agent.start;
+    double destAlpha = robot->destinationAlpha;
+    double destBeta = robot->destinationBeta;
+    long long destKey = clusterPoseKey(destAlpha, destBeta);
+    // once every obstacle is parked time no longer matters, so states
+    // are only distinguished by pose from there on.  The robot may only
+    // park at its destination once no obstacle passes by there anymore
+    int lastMove = 0;
+    for (auto & obstacle : obstacles){
+        lastMove = std::max(lastMove, (int)obstacle.collisionSegs.size() - 1);
+    }
+    ClusterPose & destPose = clusterPose(grid, agent, {destAlpha, destBeta});
+    int lastDestCollision = -1;
+    for (int stepNum=lastMove; stepNum>=0; stepNum--){
+        if (clusterCollided(destPose, stepNum, obstacles)){
+            lastDestCollision = stepNum;
+            break;
+        }
+    }
+    if (lastDestCollision == lastMove){
+        // another robot is parked in the way
+        robot->setAlphaBeta(start[0], start[1]);
+        return false;
+    }
+
+    std::vector<ClusterSearchNode> nodes;
+    // (-f, stepNum, node index), so ties in f go to the deepest node
+    std::priority_queue<std::tuple<double, int, int>> open;
+    std::set<std::pair<long long, int>> closed;
+    auto heuristic = [&](double alpha, double beta){
+        double dist = std::max(std::abs(alpha - destAlpha), std::abs(beta - destBeta));
+        return ceil(dist/grid.angStep - 1e-9);
+    };
+
+    nodes.push_back({start[0], start[1], 0, -1});
+    open.push(std::make_tuple(-heuristic(start[0], start[1]), 0, 0));
+    int nExpanded = 0;
+    int goal = -1;
+    while (open.size() != 0 and nExpanded < maxExpansions){
+        int nodeInd = std::get<2>(open.top());
+        open.pop();
+        ClusterSearchNode node = nodes[nodeInd];
+        long long poseKey = clusterPoseKey(node.alpha, node.beta);
+        auto closedKey = std::make_pair(poseKey, std::min(node.stepNum, lastMove));
+        if (closed.count(closedKey)){
+            continue;
+        }
+        closed.insert(closedKey);
+        if (poseKey == destKey and node.stepNum > lastDestCollision){
+            // robot may park here for good
+            goal = nodeInd;
+            break;
+        }
+        nExpanded++;
+        nTotalExpanded++;
+        if (node.stepNum >= grid.maxPathSteps){
+            continue;
+        }
+        int nextStep = node.stepNum + 1;
+        for (auto dAlphaBeta : grid.perturbArray){
+            double nextAlpha = node.alpha + dAlphaBeta[0];
+            double nextBeta = node.beta + dAlphaBeta[1];
+            // careful not to overshoot
+            if (node.alpha > destAlpha and nextAlpha <= destAlpha){
+                nextAlpha = destAlpha;
+            }
+            if (node.alpha < destAlpha and nextAlpha >= destAlpha){
+                nextAlpha = destAlpha;
+            }
+            if (node.beta > destBeta and nextBeta <= destBeta){
+                nextBeta = destBeta;
+            }
+            if (node.beta < destBeta and nextBeta >= destBeta){
+                nextBeta = destBeta;
+            }
+            // handle limits of travel
+            nextAlpha = std::min(std::max(nextAlpha, 0.0), 360.0);
+            nextBeta = std::min(std::max(nextBeta, 0.0), 180.0);
+
+            long long nextKey = clusterPoseKey(nextAlpha, nextBeta);
+            if (closed.count(std::make_pair(nextKey, std::min(nextStep, lastMove)))){
+                continue;
+            }
+            ClusterPose & nextPose = clusterPose(grid, agent, {nextAlpha, nextBeta});
+            if (nextPose.frozenCollided or clusterCollided(nextPose, nextStep, obstacles)){
+                continue;
+            }
+            nodes.push_back({nextAlpha, nextBeta, nextStep, nodeInd});
+            double f = nextStep + heuristic(nextAlpha, nextBeta);
+            open.push(std::make_tuple(-f, nextStep, (int)nodes.size() - 1));
+        }
+    }
+    robot->setAlphaBeta(start[0], start[1]);
+    if (goal < 0){
+        return false;
+    }
+
+    agent.path.clear();
+    for (int ind = goal; ind >= 0; ind = nodes[ind].parent){
+        agent.path.push_back({nodes[ind].alpha, nodes[ind].beta});
+    }
+    std::reverse(agent.path.begin(), agent.path.end());
+    return true;
+}
+
+std::vector<std::vector<int>> RobotGrid::deadlockedClusters(){
+    // group robots that didn't reach their destinations with their
+    // immediate neighbors.  Robots that are neighbors or share a
+    // neighbor end up in the same cluster, and clusters don't overlap
+    std::vector<std::set<int>> groups;
+    for (auto rPair : robotDict){
+        auto robot = rPair.second;
+        if (robot->score() == 0){
+            continue;
+        }
+        std::set<int> group(robot->robotNeighbors.begin(), robot->robotNeighbors.end());
+        group.insert(robot->id);
+        // absorb any existing groups this one overlaps
+        for (int ii=groups.size()-1; ii>=0; ii--){
+            bool overlaps = false;
+            for (auto robotID : groups[ii]){
+                if (group.count(robotID)){
+                    overlaps = true;
+                    break;
+                }
+            }
+            if (overlaps){
+                group.insert(groups[ii].begin(), groups[ii].end());
+                groups.erase(groups.begin() + ii);
+            }
+        }
+        groups.push_back(group);
+    }
+
+    std::vector<std::vector<int>> clusters;
+    for (auto group : groups){
+        clusters.push_back(std::vector<int>(group.begin(), group.end()));
+    }
+    return clusters;
+}
+
+bool RobotGrid::solveCluster(std::vector<int> robotIDs, int maxExpansions){
+    // plan the robots in robotIDs from their current poses to their
+    // destinations with every other robot held where it is.  On success
+    // the solution is appended to the paths of all robots (robots outside
+    // the cluster hold their poses) and true is returned, otherwise
+    // paths and poses are left untouched.
+    int nAgents = robotIDs.size();
+    std::set<int> cluster(robotIDs.begin(), robotIDs.end());
+    double minDist = 2*collisionBuffer + maxDisplacement;
+    std::vector<ClusterAgent> agents(nAgents);
+    for (int ii=0; ii<nAgents; ii++){
+        auto robot = robotDict[robotIDs[ii]];
+        if (!robot->hasDestinationAlphaBeta){
+            throw std::runtime_error("Cannot solve cluster, robot has no destination alpha/beta");
+        }
+        agents[ii].robot = robot;
+        agents[ii].start = {robot->alpha, robot->beta};
+        for (auto fiducialID : robot->fiducialNeighbors){
+            auto fiducial = fiducialDict[fiducialID];
+            double collideDist = robot->collisionBuffer + fiducial->collisionBuffer;
+            double dist2 = dist3D_Point_to_Segment(
+                    fiducial->xyzWok, robot->collisionSegWokXYZ[0],
+                    robot->collisionSegWokXYZ[1]
+                );
+            agents[ii].fiducialMinDist2[fiducialID] = std::min(dist2, collideDist*collideDist);
+        }
+        for (auto otherRobotID : robot->robotNeighbors){
+            if (cluster.count(otherRobotID)){
+                continue;
+            }
+            auto robot2 = robotDict[otherRobotID];
+            double dist2 = dist3D_Segment_to_Segment(
+                    robot2->collisionSegWokXYZ[0], robot2->collisionSegWokXYZ[1],
+                    robot->collisionSegWokXYZ[0], robot->collisionSegWokXYZ[1]
+                );
+            agents[ii].robotMinDist2[otherRobotID] = std::min(dist2, minDist*minDist);
+        }
+    }
+
+    // squared distance each pair of neighboring cluster robots must keep,
+    // as for robots outside the cluster
+    std::vector<std::vector<double>> pairMinDist2(nAgents, std::vector<double>(nAgents, -1));
+    for (int ii=0; ii<nAgents; ii++){
+        for (int jj=0; jj<nAgents; jj++){
+            auto & neighbors = agents[ii].robot->robotNeighbors;
+            if (std::find(neighbors.begin(), neighbors.end(), robotIDs[jj]) == neighbors.end()){
+                continue;
+            }
+            auto & seg1 = clusterPose(*this, agents[ii], agents[ii].start).collisionSeg;
+            auto & seg2 = clusterPose(*this, agents[jj], agents[jj].start).collisionSeg;
+            double dist2 = dist3D_Segment_to_Segment(seg1[0], seg1[1], seg2[0], seg2[1]);
+            pairMinDist2[ii][jj] = std::min(dist2, minDist*minDist);
+        }
+    }
+
+    // first try robots off their destinations first, furthest first,
+    // so their neighbors are planned to make way for them
+    std::vector<int> order;
+    for (int ii=0; ii<nAgents; ii++){
+        order.push_back(ii);
+    }
+    std::sort(order.begin(), order.end(), [&](int ii, int jj){
+        return agents[ii].robot->score() > agents[jj].robot->score();
+    });
+    // every attempt draws on one expansion budget, so a cluster that
+    // can't be solved costs at most maxClusterExpansions
+    bool solved = false;
+    nClusterExpansions = 0;
+    for (int attempt=0; attempt<maxClusterAttempts and !solved and nClusterExpansions < maxClusterExpansions; attempt++){
+        if (attempt > 0){
+            std::random_shuffle(order.begin(), order.end());
+        }
+        solved = true;
+        std::vector<int> planned;
+        for (auto ii : order){
+            std::vector<ClusterObstacle> obstacles;
+            for (auto jj : planned){
+                if (pairMinDist2[ii][jj] < 0){
+                    continue;
+                }
+                ClusterObstacle obstacle;
+                obstacle.minDist2 = pairMinDist2[ii][jj];
+                for (auto pose : agents[jj].path){
+                    obstacle.collisionSegs.push_back(clusterPose(*this, agents[jj], pose).collisionSeg);
+                }
+                obstacles.push_back(obstacle);
+            }
+            long budget = std::min((long)maxExpansions, maxClusterExpansions - nClusterExpansions);
+            if (budget <= 0 or !clusterPlanRobot(*this, agents[ii], obstacles, (int)budget, nClusterExpansions)){
+                solved = false;
+                break;
+            }
+            planned.push_back(ii);
         }
     }
 
-    nSteps = ii+1;
-}
-
-void RobotGrid::pathGenGreedy(){
-    // path gen 2 steps towards alpha beta target
-    clearPaths();
-    didFail = true;
-    greed = 1;
-    phobia = 0;
-    algType = Greedy;
-    int ii;
-    for (ii=0; ii<maxPathSteps; ii++){
-
-        bool allAtTarget = true;
+    // pose lookups moved the robots around
+    for (auto & agent : agents){
+        agent.robot->setAlphaBeta(agent.start[0], agent.start[1]);
+    }
+    if (!solved){
+        return false;
+    }
 
-        for (auto rPair : robotDict){
-            auto r = rPair.second;
-            // std::cout << "path gen " << r.betaOrientation.size() << " " << r.betaModel.size() << std::endl;
-            // std::cout << "alpha beta " << r.alpha << " " << r.beta << std::endl;
-            stepGreedy(r, ii);
-            r->scoreVec.push_back(r->score());
-            if (r->score()!=0) {
-                // could just check the last elemet in onTargetVec? same thing.
-                // or use robot->score
-                allAtTarget = false;
+    // splice the solution onto the end of everyone's paths
+    int firstStep = 0;
+    for (auto rPair : robotDict){
+        if (rPair.second->alphaPath.size() != 0){
+            firstStep = std::max(firstStep, (int)rPair.second->alphaPath.back()[0] + 1);
+        }
+    }
+    int nNewSteps = 0;
+    for (auto & agent : agents){
+        nNewSteps = std::max(nNewSteps, (int)agent.path.size() - 1);
+    }
+    for (int stepNum=1; stepNum<=nNewSteps; stepNum++){
+        for (auto & agent : agents){
+            if (stepNum < (int)agent.path.size()){
+                agent.robot->lastStepNum = firstStep + stepNum - 1;
+                agent.robot->setAlphaBeta(agent.path[stepNum][0], agent.path[stepNum][1]);
             }
         }
+        for (auto rPair : robotDict){
+            rPair.second->addPathPoint(firstStep + stepNum - 1);
+            rPair.second->scoreVec.push_back(rPair.second->score());
+        }
+    }
+    nSteps = firstStep + nNewSteps;
+    return true;
+}
 
-        if (allAtTarget){
-            // std::cout << "all at target" << std::endl;
-            didFail = false;
+int RobotGrid::resolveDeadlocks(int maxClusterSize, int maxExpansions){
+    // after a failed path gen, try to unjam each small deadlocked
+    // cluster with solveCluster rather than replanning the whole grid.
+    // Returns the number of clusters solved.
+    for (auto rPair : robotDict){
+        if (rPair.second->streamPath){
+            throw std::runtime_error("Cannot resolve deadlocks, paths were simplified during path gen");
+        }
+        if (rPair.second->alphaPath.size() == 0){
+            throw std::runtime_error("Cannot resolve deadlocks, generate paths first");
+        }
+    }
+    // robots parked by one solution may free up another cluster,
+    // so keep going while progress is made
+    int nSolved = 0;
+    bool progress = true;
+    while (progress){
+        progress = false;
+        for (auto cluster : deadlockedClusters()){
+            if ((int)cluster.size() > maxClusterSize){
+                continue;
+            }
+            if (solveCluster(cluster, maxExpansions)){
+                nSolved++;
+                progress = true;
+            }
+        }
+    }
+    didFail = false;
+    for (auto rPair : robotDict){
+        if (rPair.second->score() != 0){
+            didFail = true;
             break;
         }
     }
-
-    nSteps = ii+1;
+    return nSolved;
 }
 
 
@@ -384,6 +2181,7 @@ void RobotGrid::pathGenGreedy(){
 
 void RobotGrid::clearTargetDict(){
     targetDict.clear(); // does clear destroy the shared_ptrs?
+    targetVersion++;
     // clear all robot target lists
     for (auto rPair : robotDict){
         auto r = rPair.second;
@@ -494,48 +2292,74 @@ void RobotGrid::assignRobot2Target(int robotID, long targetID){
     robot->setAlphaBeta(ab[0], ab[1]);
 }
 
-bool RobotGrid::isValidAssignment(int robotID, long targetID){
-    auto robot = robotDict[robotID];
-    auto target = targetDict[targetID];
+// collision checks for a robot whose collision segment is seg, which
+// need not be where the robot actually is.  Same tests and distances
+// as robotColliders/fiducialColliders, the grid is only read
+static std::vector<int> segRobotColliders(
+    const RobotGrid & grid, const Robot & robot, const std::array<vec3, 2> & seg
+){
+    std::vector<int> collidingNeighbors;
+    double collideDist = 2*grid.collisionBuffer + grid.maxDisplacement;
+    for (auto otherRobotID : robot.robotNeighbors){
+        auto & robot2 = grid.robotDict.at(otherRobotID);
+        // squared distance returned
+        double dist2 = dist3D_Segment_to_Segment(
+                robot2->collisionSegWokXYZ[0], robot2->collisionSegWokXYZ[1],
+                seg[0], seg[1]
+            );
+        if (sqrt(dist2) < collideDist){
+            collidingNeighbors.push_back(robot2->id);
+        }
+    }
+    return collidingNeighbors;
+}
 
-    if (target->fiberType == ApogeeFiber and !robot->hasApogee){
-        return false;
+static std::vector<int> segFiducialColliders(
+    const RobotGrid & grid, const Robot & robot, const std::array<vec3, 2> & seg
+){
+    std::vector<int> collidingNeighbors;
+    for (auto fiducialID : robot.fiducialNeighbors){
+        auto & fiducial = grid.fiducialDict.at(fiducialID);
+        double dist2 = dist3D_Point_to_Segment(fiducial->xyzWok, seg[0], seg[1]);
+        double collideDist2 = (robot.collisionBuffer+fiducial->collisionBuffer) *
+                              (robot.collisionBuffer+fiducial->collisionBuffer);
+        if (dist2 < collideDist2){
+            collidingNeighbors.push_back(fiducial->id);
+        }
     }
+    return collidingNeighbors;
+}
 
-    // first a quick position cut
-    // quick position cut fails near edges, get rid of it
-    // double targDist2 = (target->x - robot->xPos) * (target->x - robot->xPos) +
-    //   (target->y - robot->yPos) * (target->y - robot->yPos) ;
-    // if (targDist2 > maxReachCheck2) {
-    //   return false;
-    // }
+std::vector<int> RobotGrid::robotCollidersAt(int robotID, double alpha, double beta) const {
+    // robots the given robot would collide with at alpha/beta,
+    // everyone (including this robot) stays where they are
+    auto & robot = robotDict.at(robotID);
+    return segRobotColliders(*this, *robot, robot->collisionSegAt(alpha, beta));
+}
 
-    auto ab = robot->alphaBetaFromWokXYZ(target->xyzWok, target->fiberType);
+std::vector<int> RobotGrid::fiducialCollidersAt(int robotID, double alpha, double beta) const {
+    auto & robot = robotDict.at(robotID);
+    return segFiducialColliders(*this, *robot, robot->collisionSegAt(alpha, beta));
+}
+
+bool RobotGrid::canReach(int robotID, vec3 xyzWok, FiberType fiberType) const {
+    // whether the robot could put the fiber on the wok position without
+    // hitting a fiducial (fiducials are immobile), the robot isn't moved
+    auto & robot = robotDict.at(robotID);
+    if (fiberType == ApogeeFiber and !robot->hasApogee){
+        return false;
+    }
+    auto ab = robot->alphaBetaFromWokXYZ(xyzWok, fiberType);
     // check alpha beta valid
     if (std::isnan(ab[0]) or std::isnan(ab[1])){
         return false;
     }
-    // check alpha beta in range
-    // if (ab[0]<0 or ab[0]>=360){
-    //     return false;
-    // }
-    // if (ab[1]<0 or ab[1]>180){
-    //     return false;
-    // }
+    return fiducialCollidersAt(robotID, ab[0], ab[1]).size() == 0;
+}
 
-    // save current alpha beta
-    double savedAlpha = robot->alpha;
-    double savedBeta = robot->beta;
-    robot->setAlphaBeta(ab[0], ab[1]);
-    auto collidedFiducials = fiducialColliders(robotID);
-    if (collidedFiducials.size() != 0){
-        // this target interferes with a fiducial which is immobile
-        robot->setAlphaBeta(savedAlpha, savedBeta);
-        return false;
-    }
-    // reset alpha beta
-    robot->setAlphaBeta(savedAlpha, savedBeta);
-    return true;
+bool RobotGrid::isValidAssignment(int robotID, long targetID) const {
+    auto & target = targetDict.at(targetID);
+    return canReach(robotID, target->xyzWok, target->fiberType);
 }
 
 
@@ -552,13 +2376,13 @@ bool RobotGrid::isCollided(int robotID){
     return false;
 }
 
-std::tuple<bool, bool, std::vector<int>> RobotGrid::isCollidedWithAssigned(int robotID){
+std::tuple<bool, bool, std::vector<int>> RobotGrid::isCollidedWithAssigned(int robotID) const {
   bool collided, fiducial_collided;
   std::vector<int> assignedRobotsColliding;
   auto robotsColliding = robotColliders(robotID);
   if (robotsColliding.size() != 0){
     for (auto robotColliding : robotsColliding) {
-      if(robotDict[robotColliding]->isAssigned()) {
+      if(robotDict.at(robotColliding)->isAssigned()) {
 	assignedRobotsColliding.push_back(robotColliding);
       }
     }
@@ -575,31 +2399,384 @@ void RobotGrid::homeRobot(int robotID){
 		robot->setAlphaBeta(0., 180.);
 }
 
-std::tuple<bool, bool, std::vector<int>> RobotGrid::wouldCollideWithAssigned(int robotID, long targID){
-  long currentTargetID;
-  int currentRobotID;
-  std::tuple<bool, bool, std::vector<int>> result;
-  
-  auto robot = robotDict[robotID];
-  if(robot->isAssigned())
-    currentTargetID = robot->assignedTargetID;
-  else
-    currentTargetID = -1;
-  
-  currentRobotID = targetDict[targID]->assignedRobotID;
-
-  assignRobot2Target(robotID, targID);
-  result = isCollidedWithAssigned(robotID);
-  
-  if(currentTargetID >= 0)
-    assignRobot2Target(robotID, currentTargetID);
-  else
-    unassignRobot(robotID);
-  
-  if(currentRobotID >= 0)
-    assignRobot2Target(currentRobotID, targID);
-  
-  return result;
+std::tuple<bool, bool, std::vector<int>> RobotGrid::wouldCollideWithAssigned(int robotID, long targID) const {
+    // isCollidedWithAssigned as if assignRobot2Target(robotID, targID)
+    // were called, without assigning or moving anything.  A robot
+    // holding the target would lose it, so it doesn't count
+    auto & robot = robotDict.at(robotID);
+    auto & target = targetDict.at(targID);
+    int ii = std::count(robot->validTargetIDs.begin(), robot->validTargetIDs.end(), targID);
+    if (ii == 0){
+        throw std::runtime_error("target not valid for robot");
+    }
+    auto ab = robot->alphaBetaFromWokXYZ(target->xyzWok, target->fiberType);
+    auto collisionSeg = robot->collisionSegAt(ab[0], ab[1]);
+
+    std::vector<int> assignedRobotsColliding;
+    for (auto robotColliding : segRobotColliders(*this, *robot, collisionSeg)){
+        auto & robot2 = robotDict.at(robotColliding);
+        if (robot2->isAssigned() and robot2->id != target->assignedRobotID){
+            assignedRobotsColliding.push_back(robotColliding);
+        }
+    }
+    bool fiducialCollided = segFiducialColliders(*this, *robot, collisionSeg).size() != 0;
+    bool collided = fiducialCollided || (assignedRobotsColliding.size() != 0);
+    return std::make_tuple(collided, fiducialCollided, assignedRobotsColliding);
+}
+
+
+void RobotGrid::buildConflictGraph(int nThreads){
+    // every valid (robot, target) pair is a node.  Two nodes conflict
+    // if they claim the same target, or if neighboring robots placed
+    // on their targets would collide (same test as robotColliders).
+    // Nodes of the same robot are exclusive anyway and get no edges.
+    // Neighboring robots are checked in parallel.
+    conflictGraphVersion = targetVersion;
+    std::vector<std::shared_ptr<Robot>> robots;
+    robotFirstNode.clear();
+    nodeRobotIDs.clear();
+    nodeTargetIDs.clear();
+    for (auto rPair : robotDict){
+        auto robot = rPair.second;
+        robotFirstNode[robot->id] = nodeRobotIDs.size();
+        robots.push_back(robot);
+        for (auto targID : robot->validTargetIDs){
+            nodeRobotIDs.push_back(robot->id);
+            nodeTargetIDs.push_back(targID);
+        }
+    }
+    int nNodes = nodeRobotIDs.size();
+
+    // collision segments on target, and a bounding circle to skip
+    // the full segment distance for pairs far apart
+    std::vector<std::array<vec3, 2>> nodeSegs(nNodes);
+    std::vector<vec3> nodeCenters(nNodes);
+    std::vector<double> nodeRadii(nNodes);
+    parallelFor(nNodes, nThreads, [&](int node){
+        auto & robot = robotDict.at(nodeRobotIDs[node]);
+        auto & target = targetDict.at(nodeTargetIDs[node]);
+        auto ab = robot->alphaBetaFromWokXYZ(target->xyzWok, target->fiberType);
+        auto & seg = nodeSegs[node];
+        seg = robot->collisionSegAt(ab[0], ab[1]);
+        double dx = seg[1][0] - seg[0][0];
+        double dy = seg[1][1] - seg[0][1];
+        double dz = seg[1][2] - seg[0][2];
+        nodeCenters[node] = {seg[0][0] + dx/2, seg[0][1] + dy/2, seg[0][2] + dz/2};
+        nodeRadii[node] = sqrt(dx*dx + dy*dy + dz*dz) / 2;
+    });
+    std::map<long, std::vector<int>> targetNodes;
+    for (int node = 0; node < nNodes; node++){
+        targetNodes[nodeTargetIDs[node]].push_back(node);
+    }
+
+    // robot pairs are checked once, from the lower robot ID
+    double collideDist = 2*collisionBuffer + maxDisplacement;
+    std::vector<std::vector<std::array<int, 2>>> robotConflicts(robots.size());
+    parallelFor(robots.size(), nThreads, [&](int ii){
+        auto & robot = robots[ii];
+        int firstNode = robotFirstNode.at(robot->id);
+        int endNode = firstNode + robot->validTargetIDs.size();
+        for (auto otherRobotID : robot->robotNeighbors){
+            if (otherRobotID < robot->id){
+                continue;
+            }
+            int otherFirst = robotFirstNode.at(otherRobotID);
+            int otherEnd = otherFirst + robotDict.at(otherRobotID)->validTargetIDs.size();
+            for (int node = firstNode; node < endNode; node++){
+                for (int otherNode = otherFirst; otherNode < otherEnd; otherNode++){
+                    if (nodeTargetIDs[node] == nodeTargetIDs[otherNode]){
+                        continue; // added below
+                    }
+                    double dx = nodeCenters[node][0] - nodeCenters[otherNode][0];
+                    double dy = nodeCenters[node][1] - nodeCenters[otherNode][1];
+                    double dz = nodeCenters[node][2] - nodeCenters[otherNode][2];
+                    double reach = collideDist + nodeRadii[node] + nodeRadii[otherNode];
+                    if (dx*dx + dy*dy + dz*dz >= reach*reach){
+                        continue;
+                    }
+                    double dist2 = dist3D_Segment_to_Segment(
+                        nodeSegs[otherNode][0], nodeSegs[otherNode][1],
+                        nodeSegs[node][0], nodeSegs[node][1]
+                    );
+                    if (sqrt(dist2) < collideDist){
+                        robotConflicts[ii].push_back({node, otherNode});
+                    }
+                }
+            }
+        }
+    });
+
+    std::vector<std::vector<int>> nodeConflicts(nNodes);
+    for (auto & targetNode : targetNodes){
+        for (auto node : targetNode.second){
+            for (auto otherNode : targetNode.second){
+                if (otherNode != node){
+                    nodeConflicts[node].push_back(otherNode);
+                }
+            }
+        }
+    }
+    for (auto & conflicts : robotConflicts){
+        for (auto & conflict : conflicts){
+            nodeConflicts[conflict[0]].push_back(conflict[1]);
+            nodeConflicts[conflict[1]].push_back(conflict[0]);
+        }
+    }
+    conflictStart.assign(nNodes + 1, 0);
+    for (int node = 0; node < nNodes; node++){
+        conflictStart[node+1] = conflictStart[node] + nodeConflicts[node].size();
+    }
+    conflictNodes.resize(conflictStart[nNodes]);
+    parallelFor(nNodes, nThreads, [&](int node){
+        auto & conflicts = nodeConflicts[node];
+        std::sort(conflicts.begin(), conflicts.end());
+        std::copy(conflicts.begin(), conflicts.end(), conflictNodes.begin() + conflictStart[node]);
+    });
+}
+
+int RobotGrid::conflictNode(int robotID, long targID) const {
+    auto firstNode = robotFirstNode.find(robotID);
+    if (conflictGraphVersion != targetVersion){
+        throw std::runtime_error("Conflict graph is stale, buildConflictGraph first");
+    }
+    if (firstNode == robotFirstNode.end()){
+        throw std::runtime_error("Robot not in conflict graph, buildConflictGraph first");
+    }
+    int nNodes = nodeRobotIDs.size();
+    for (int node = firstNode->second; node < nNodes && nodeRobotIDs[node] == robotID; node++){
+        if (nodeTargetIDs[node] == targID){
+            return node;
+        }
+    }
+    return -1;
+}
+
+bool RobotGrid::nodesConflict(int node1, int node2) const {
+    if (node1 < 0 || node2 < 0 || node1 + 1 >= (int)conflictStart.size() || node2 + 1 >= (int)conflictStart.size()){
+        throw std::runtime_error("Conflict graph node out of range");
+    }
+    return std::binary_search(
+        conflictNodes.begin() + conflictStart[node1],
+        conflictNodes.begin() + conflictStart[node1+1], node2
+    );
+}
+
+
+// Assignment state over the conflict graph.  A node is blocked by
+// every chosen node it conflicts with, and by another chosen node of
+// its own robot, it may be chosen only when nothing blocks it.
+struct AssignState {
+    const RobotGrid & grid;
+    std::vector<double> weights;
+    std::vector<bool> chosen;
+    std::vector<int> nBlockers;
+    std::map<int, int> robotNode; // robot ID -> chosen node
+
+    AssignState(const RobotGrid & grid, bool usePriority) :
+        grid(grid), weights(grid.nodeRobotIDs.size(), 1),
+        chosen(grid.nodeRobotIDs.size(), false),
+        nBlockers(grid.nodeRobotIDs.size(), 0)
+    {
+        if (grid.conflictGraphVersion != grid.targetVersion){
+            throw std::runtime_error("Conflict graph is stale, buildConflictGraph first");
+        }
+        if (usePriority){
+            for (int node = 0; node < (int)weights.size(); node++){
+                weights[node] = grid.targetDict.at(grid.nodeTargetIDs[node])->priority;
+            }
+        }
+    }
+
+    template <typename F> void forBlocked(int node, F func){
+        // nodes a chosen node blocks, its conflicts and its robot's other nodes
+        for (int ii = grid.conflictStart[node]; ii < grid.conflictStart[node+1]; ii++){
+            func(grid.conflictNodes[ii]);
+        }
+        int nNodes = grid.nodeRobotIDs.size();
+        int robotID = grid.nodeRobotIDs[node];
+        for (int other = grid.robotFirstNode.at(robotID); other < nNodes && grid.nodeRobotIDs[other] == robotID; other++){
+            if (other != node){
+                func(other);
+            }
+        }
+    }
+
+    void choose(int node){
+        chosen[node] = true;
+        robotNode[grid.nodeRobotIDs[node]] = node;
+        forBlocked(node, [&](int other){ nBlockers[other]++; });
+    }
+
+    void drop(int node){
+        chosen[node] = false;
+        robotNode.erase(grid.nodeRobotIDs[node]);
+        forBlocked(node, [&](int other){ nBlockers[other]--; });
+    }
+
+    bool compatible(int node1, int node2) const {
+        return grid.nodeRobotIDs[node1] != grid.nodeRobotIDs[node2] &&
+               !grid.nodesConflict(node1, node2);
+    }
+};
+
+static void applyAssignment(RobotGrid & grid, const AssignState & state){
+    // replace the grid's assignments with the chosen nodes
+    for (auto rPair : grid.robotDict){
+        grid.unassignRobot(rPair.first);
+    }
+    for (auto & robotNode : state.robotNode){
+        grid.assignRobot2Target(robotNode.first, grid.nodeTargetIDs[robotNode.second]);
+    }
+}
+
+static AssignState currentAssignment(RobotGrid & grid, bool usePriority){
+    AssignState state(grid, usePriority);
+    for (auto rPair : grid.robotDict){
+        auto robot = rPair.second;
+        if (robot->isAssigned()){
+            int node = grid.conflictNode(robot->id, robot->assignedTargetID);
+            if (node >= 0){
+                state.choose(node);
+            }
+        }
+    }
+    return state;
+}
+
+void RobotGrid::greedyAssign(bool usePriority){
+    // assign targets from scratch, heaviest (priority, or every target
+    // alike) first and among equals those conflicting with the fewest
+    // others, skipping any blocked by an earlier choice.  Uses the
+    // conflict graph, so assigned robots never collide on their targets
+    AssignState state(*this, usePriority);
+    std::vector<int> order(nodeRobotIDs.size());
+    for (int node = 0; node < (int)order.size(); node++){
+        order[node] = node;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int node1, int node2){
+        if (state.weights[node1] != state.weights[node2]){
+            return state.weights[node1] > state.weights[node2];
+        }
+        return conflictStart[node1+1] - conflictStart[node1] <
+               conflictStart[node2+1] - conflictStart[node2];
+    });
+    for (auto node : order){
+        if (state.nBlockers[node] == 0 && state.weights[node] >= 0){
+            state.choose(node);
+        }
+    }
+    applyAssignment(*this, state);
+}
+
+int RobotGrid::pairwiseSwap(bool usePriority, int maxPasses){
+    // local search from the current assignment.  Each assigned node is
+    // tried against the unassigned nodes only it blocks, if a set of
+    // those that don't block each other outweighs it they replace it
+    // (a better target for the same robot, or two robots sharing the
+    // space one used).  Unblocked nodes are taken for free.  Stops
+    // after a pass without a swap.
+    AssignState state = currentAssignment(*this, usePriority);
+    int nNodes = nodeRobotIDs.size();
+    int nSwaps = 0;
+    for (int pass = 0; pass < maxPasses; pass++){
+        int nPassSwaps = 0;
+        for (int node = 0; node < nNodes; node++){
+            if (!state.chosen[node] && state.nBlockers[node] == 0 && state.weights[node] >= 0){
+                state.choose(node);
+                nPassSwaps++;
+            }
+        }
+        for (int node = 0; node < nNodes; node++){
+            if (!state.chosen[node]){
+                continue;
+            }
+            std::vector<int> candidates;
+            state.forBlocked(node, [&](int other){
+                if (!state.chosen[other] && state.nBlockers[other] == 1){
+                    candidates.push_back(other);
+                }
+            });
+            std::sort(candidates.begin(), candidates.end(), [&](int node1, int node2){
+                if (state.weights[node1] != state.weights[node2]){
+                    return state.weights[node1] > state.weights[node2];
+                }
+                return node1 < node2;
+            });
+            std::vector<int> picks;
+            double pickWeight = 0;
+            for (auto candidate : candidates){
+                bool fits = true;
+                for (auto pick : picks){
+                    if (!state.compatible(candidate, pick)){
+                        fits = false;
+                        break;
+                    }
+                }
+                if (fits){
+                    picks.push_back(candidate);
+                    pickWeight += state.weights[candidate];
+                }
+            }
+            if (pickWeight > state.weights[node] + 1e-9){
+                state.drop(node);
+                for (auto pick : picks){
+                    state.choose(pick);
+                }
+                nPassSwaps++;
+            }
+        }
+        nSwaps += nPassSwaps;
+        if (nPassSwaps == 0){
+            break;
+        }
+    }
+    applyAssignment(*this, state);
+    return nSwaps;
+}
+
+double RobotGrid::optimizeTargets(bool usePriority, int maxPasses, int nThreads){
+    // assign targets to maximize the total priority (or the number of
+    // assigned targets) with no two assigned robots colliding on their
+    // targets.  Robots left unassigned keep their pose unless they
+    // collide, those are folded home, or moved at random like
+    // decollideGrid if home is in the way.  Assigned robots don't move.
+    buildConflictGraph(nThreads);
+    greedyAssign(usePriority);
+    pairwiseSwap(usePriority, maxPasses);
+    std::vector<int> unassignedIDs;
+    for (auto rPair : robotDict){
+        if (!rPair.second->isAssigned()){
+            unassignedIDs.push_back(rPair.first);
+        }
+    }
+    for (auto robotID : unassignedIDs){
+        if (isCollided(robotID)){
+            homeRobot(robotID);
+        }
+    }
+    for (int ii = 0; ii < 1000; ii++){
+        bool anyCollided = false;
+        for (auto robotID : unassignedIDs){
+            if (isCollided(robotID)){
+                anyCollided = true;
+                decollideRobot(robotID);
+            }
+        }
+        if (!anyCollided){
+            break;
+        }
+    }
+    if (getNCollisions()){
+        throw std::runtime_error("Unable to decollide unassigned robots");
+    }
+    double total = 0;
+    for (auto rPair : robotDict){
+        auto robot = rPair.second;
+        if (robot->isAssigned()){
+            total += usePriority ? targetDict.at(robot->assignedTargetID)->priority : 1;
+        }
+    }
+    return total;
 }
 
 
@@ -630,56 +2807,72 @@ bool RobotGrid::neighborEncroachment(std::shared_ptr<Robot> robot1){
 }
 
 
-std::vector<int> RobotGrid::robotColliders(int robotID){
-
-    std::vector<int> collidingNeighbors;
-    double dist2, collideDist2, dist;
-    // check collisions with neighboring robots
-    auto robot1 = robotDict[robotID];
-    // std::cout << "robot max displace " << maxDisplacement << std::endl;
-    for (auto otherRobotID : robot1->robotNeighbors){
-        auto robot2 = robotDict[otherRobotID];
-        // squared distance returned
-        dist2 = dist3D_Segment_to_Segment(
+double RobotGrid::clearance(int robotID){
+    // return how far (mm) this robot's collision segment may travel before
+    // a collision with a neighbor or fiducial becomes possible.  Neighbors
+    // move too, so the gap to a neighbor is split evenly between the two.
+    double dist, gap;
+    auto robot = robotDict.at(robotID);
+    double minGap = 1e16;
+    for (auto otherRobotID : robot->robotNeighbors){
+        auto robot2 = robotDict.at(otherRobotID);
+        dist = sqrt(dist3D_Segment_to_Segment(
                 robot2->collisionSegWokXYZ[0], robot2->collisionSegWokXYZ[1],
-                robot1->collisionSegWokXYZ[0], robot1->collisionSegWokXYZ[1]
-            );
-        dist = sqrt(dist2);
-        // collideDist2 = (2*collisionBuffer)*(2*collisionBuffer);
-        if (dist < (2*collisionBuffer + maxDisplacement)){
-            // std::cout << "dist " << dist2 - collide_dist_squared << std::endl;
-            collidingNeighbors.push_back(robot2->id);
+                robot->collisionSegWokXYZ[0], robot->collisionSegWokXYZ[1]
+            ));
+        // same collision distance as robotColliders
+        gap = 0.5*(dist - (2*collisionBuffer + maxDisplacement));
+        if (gap < minGap){
+            minGap = gap;
         }
-
     }
-    return collidingNeighbors;
-}
-
-std::vector<int> RobotGrid::fiducialColliders(int robotID){
-
-    std::vector<int> collidingNeighbors;
-    auto robot = robotDict[robotID];
-    // std::cout << "isFiducialCollided" << std::endl;
-    double dist2, collideDist2;
-    // std::cout << "n fiducials " << fiducials.size() << std::endl;
     for (auto fiducialID : robot->fiducialNeighbors){
-        auto fiducial = fiducialDict[fiducialID];
-        // squared distance
-        // std::array<double, 2> xyCoord = {fiducial->x, fiducial->y};
-        // vec3 xyzCoord = {fiducial->x, fiducial->y, focalZ};
-        dist2 = dist3D_Point_to_Segment(
+        auto fiducial = fiducialDict.at(fiducialID);
+        dist = sqrt(dist3D_Point_to_Segment(
                 fiducial->xyzWok, robot->collisionSegWokXYZ[0],
                 robot->collisionSegWokXYZ[1]
-                );
-        collideDist2 =  (robot->collisionBuffer+fiducial->collisionBuffer) *
-                        (robot->collisionBuffer+fiducial->collisionBuffer);
-
-        if (dist2 < collideDist2){
-            collidingNeighbors.push_back(fiducial->id);
+            ));
+        // same collision distance as fiducialColliders.  Skipping checks
+        // relies on this being a true distance, one that a move of
+        // maxDisplacement can close by at most that much, which holds
+        // only since the point to segment distance is measured to the
+        // projected point and not as dot(point, projection)
+        gap = dist - (robot->collisionBuffer + fiducial->collisionBuffer);
+        if (gap < minGap){
+            minGap = gap;
         }
     }
-    return collidingNeighbors;
+    return minGap;
+}
+
+bool RobotGrid::isClearForStep(std::shared_ptr<Robot> robot, int stepNum){
+    // return true if the robot is far enough from everything that no
+    // move considered at this step can collide, in which case collision
+    // checks may be skipped.  Every step moves an arm by at most
+    // maxDisplacement, so a clearance measured now guarantees checks
+    // j steps from now pass as long as (j+1)*maxDisplacement < clearance.
+    // Robots idling at their destination only make this more conservative.
+    if (!skipClearChecks){
+        return false;
+    }
+    if (stepNum <= robot->clearUntilStep){
+        return true;
+    }
+    robot->clearance = clearance(robot->id);
+    int nClearSteps = (int)ceil(robot->clearance / maxDisplacement) - 1;
+    robot->clearUntilStep = stepNum + nClearSteps - 1;
+    return nClearSteps > 0;
+}
+
+std::vector<int> RobotGrid::robotColliders(int robotID) const {
+    // check collisions with neighboring robots
+    auto & robot = robotDict.at(robotID);
+    return segRobotColliders(*this, *robot, robot->collisionSegWokXYZ);
+}
 
+std::vector<int> RobotGrid::fiducialColliders(int robotID) const {
+    auto & robot = robotDict.at(robotID);
+    return segFiducialColliders(*this, *robot, robot->collisionSegWokXYZ);
 }
 
 bool RobotGrid::throwAway(int robotID){
@@ -786,6 +2979,16 @@ std::vector<int> RobotGrid::deadlockedRobots(){
 }
 
 void RobotGrid::stepGreedy(std::shared_ptr<Robot> robot, int stepNum){
+    stepGreedy(robot, stepNum, perturbArray, NULL, nSkippedChecks);
+}
+
+void RobotGrid::stepGreedy(
+    std::shared_ptr<Robot> robot, int stepNum, std::vector<vec2> & perturbations,
+    std::mt19937 * rng, long & nSkipped
+){
+    // greedy step with caller supplied perturbations, random generator
+    // and skip counter, so robots in separate tiles can be stepped
+    // from separate threads.  A NULL rng uses the global rand()
 
     double score;
     double currAlpha = robot->alpha;
@@ -797,42 +3000,24 @@ void RobotGrid::stepGreedy(std::shared_ptr<Robot> robot, int stepNum){
     // bestScore = robot->score() + 1/closestApproach2(robot->id);
     // bestScore = 1e16;
 
-    vec2 alphaPathPoint;
-    vec2 betaPathPoint;
-    vec2 temp;
-
-    alphaPathPoint[0] = stepNum;
-    betaPathPoint[0] = stepNum;
-
-
     if (robot->score()==0){
         // at target don't move
-        alphaPathPoint[1] = currAlpha;
-        betaPathPoint[1] = currBeta;
-        robot->alphaPath.push_back(alphaPathPoint);
-        robot->betaPath.push_back(betaPathPoint);
-        // robot->onTargetVec.push_back(true);
-
-        // note make collision segment just two points
-
-        temp[0] = stepNum;
-        temp[1] = robot->collisionSegWokXYZ[0][0]; // xAlphaEnd
-        robot->roughAlphaX.push_back(temp);
-        temp[1] = robot->collisionSegWokXYZ[0][1]; // yAlphaEnd
-        robot->roughAlphaY.push_back(temp);
-        temp[1] = robot->collisionSegWokXYZ.back()[0]; // xBetaEnd
-        robot->roughBetaX.push_back(temp);
-        temp[1] = robot->collisionSegWokXYZ.back()[1]; // yBetaEnd
-        robot->roughBetaY.push_back(temp);
-
+        robot->addPathPoint(stepNum);
         return;
     }
 
     robot->lastStepNum = stepNum;
+    bool isClear = isClearForStep(robot, stepNum);
 
-    std::random_shuffle(perturbArray.begin(), perturbArray.end());
+    if (rng == NULL){
+        std::random_shuffle(perturbations.begin(), perturbations.end());
+    }
+    else {
+        std::shuffle(perturbations.begin(), perturbations.end(), *rng);
+    }
+    std::uniform_real_distribution<double> coinFlip(0, 1);
     // check all move combinations for each axis
-    for (auto dAlphaBeta : perturbArray){
+    for (auto dAlphaBeta : perturbations){
         nextAlpha = currAlpha + dAlphaBeta[0];
         nextBeta = currBeta + dAlphaBeta[1];
         // careful not to overshoot
@@ -867,8 +3052,11 @@ void RobotGrid::stepGreedy(std::shared_ptr<Robot> robot, int stepNum){
         robot->setAlphaBeta(nextAlpha, nextBeta);
         score = robot->score();
         // double encroachment = 0;
+        if (isClear){
+            nSkipped++;
+        }
 
-        if (!isCollided(robot->id)){
+        if (isClear or !isCollided(robot->id)){
             if (score < bestScore){
                 bestScore = score;
                 bestAlpha = nextAlpha;
@@ -876,7 +3064,7 @@ void RobotGrid::stepGreedy(std::shared_ptr<Robot> robot, int stepNum){
 
             }
 
-            else if (score == bestScore and randomSample() >= 0.5){
+            else if (score == bestScore and (rng == NULL ? randomSample() : coinFlip(*rng)) >= 0.5){
                 // flip a coin to see whether to accept
                 bestScore = score;
                 bestAlpha = nextAlpha;
@@ -887,20 +3075,7 @@ void RobotGrid::stepGreedy(std::shared_ptr<Robot> robot, int stepNum){
 
     // set alpha beta to best found option
     robot->setAlphaBeta(bestAlpha, bestBeta);
-    alphaPathPoint[1] = bestAlpha;
-    betaPathPoint[1] = bestBeta;
-    robot->alphaPath.push_back(alphaPathPoint);
-    robot->betaPath.push_back(betaPathPoint);
-
-    temp[0] = stepNum;
-    temp[1] = robot->collisionSegWokXYZ[0][0]; // xAlphaEnd
-    robot->roughAlphaX.push_back(temp);
-    temp[1] = robot->collisionSegWokXYZ[0][1]; // yAlphaEnd
-    robot->roughAlphaY.push_back(temp);
-    temp[1] = robot->collisionSegWokXYZ.back()[0]; // xBetaEnd
-    robot->roughBetaX.push_back(temp);
-    temp[1] = robot->collisionSegWokXYZ.back()[1]; // yBetaEnd
-    robot->roughBetaY.push_back(temp);
+    robot->addPathPoint(stepNum);
 
 
 }
@@ -921,36 +3096,12 @@ void RobotGrid::stepMDP(std::shared_ptr<Robot> robot, int stepNum){
     // bestScore = robot->score() + 1/closestApproach2(robot->id);
     // bestScore = 1e16;
 
-    vec2 alphaPathPoint;
-    vec2 betaPathPoint;
-    vec2 temp;
-
-    alphaPathPoint[0] = stepNum;
-    betaPathPoint[0] = stepNum;
-
     // nextAlpha, nextBeta, local energy, score
     // std::vector<std::array<double, 4>> stateOptions;
 
     if (robot->score()==0 and !neighborEncroachment(robot)){
         // done folding no one knocking don't move
-        alphaPathPoint[1] = currAlpha;
-        betaPathPoint[1] = currBeta;
-        robot->alphaPath.push_back(alphaPathPoint);
-        robot->betaPath.push_back(betaPathPoint);
-        // robot->onTargetVec.push_back(true);
-
-        // note make collision segment just two points
-
-        temp[0] = stepNum;
-        temp[1] = robot->collisionSegWokXYZ[0][0]; // xAlphaEnd
-        robot->roughAlphaX.push_back(temp);
-        temp[1] = robot->collisionSegWokXYZ[0][1]; // yAlphaEnd
-        robot->roughAlphaY.push_back(temp);
-        temp[1] = robot->collisionSegWokXYZ.back()[0]; // xBetaEnd
-        robot->roughBetaX.push_back(temp);
-        temp[1] = robot->collisionSegWokXYZ.back()[1]; // yBetaEnd
-        robot->roughBetaY.push_back(temp);
-
+        robot->addPathPoint(stepNum);
         return;
     }
 
@@ -964,6 +3115,8 @@ void RobotGrid::stepMDP(std::shared_ptr<Robot> robot, int stepNum){
     // or minimizing score
 
     doPhobia = randomSample() < phobia;
+    // phobia needs distances to every neighbor, so only skip otherwise
+    bool isClear = !doPhobia and isClearForStep(robot, stepNum);
 
 
     for (auto dAlphaBeta : perturbArray){
@@ -1002,7 +3155,13 @@ void RobotGrid::stepMDP(std::shared_ptr<Robot> robot, int stepNum){
         bool isCollided = false;
 
         // compute robot's local energy, and check for collision
+        if (isClear){
+            nSkippedChecks++;
+        }
         for (auto otherRobotID : robot->robotNeighbors){
+            if (isClear){
+                break;
+            }
             auto otherRobot = robotDict[otherRobotID];
             dist2 = dist3D_Segment_to_Segment(
                 otherRobot->collisionSegWokXYZ[0], otherRobot->collisionSegWokXYZ[1],
@@ -1051,20 +3210,7 @@ void RobotGrid::stepMDP(std::shared_ptr<Robot> robot, int stepNum){
 
     // set alpha beta to best found option
     robot->setAlphaBeta(bestAlpha, bestBeta);
-    alphaPathPoint[1] = bestAlpha;
-    betaPathPoint[1] = bestBeta;
-    robot->alphaPath.push_back(alphaPathPoint);
-    robot->betaPath.push_back(betaPathPoint);
-
-    temp[0] = stepNum;
-    temp[1] = robot->collisionSegWokXYZ[0][0]; // xAlphaEnd
-    robot->roughAlphaX.push_back(temp);
-    temp[1] = robot->collisionSegWokXYZ[0][1]; // yAlphaEnd
-    robot->roughAlphaY.push_back(temp);
-    temp[1] = robot->collisionSegWokXYZ.back()[0]; // xBetaEnd
-    robot->roughBetaX.push_back(temp);
-    temp[1] = robot->collisionSegWokXYZ.back()[1]; // yBetaEnd
-    robot->roughBetaY.push_back(temp);
+    robot->addPathPoint(stepNum);
     robot->nudge = false;
 }
 
@@ -0,0 +1,487 @@
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "robotGrid.h"
+
+// Binary snapshot of a RobotGrid.  Layout (native byte order, checked on
+// load): an 8 byte magic, uint32 version, uint32 byte order mark, then the
+// grid scalars, robots, fiducials, targets and conflict graph in the order
+// written below.  Arrays are a uint64 length followed by the raw elements,
+// padded so every array starts on an 8 byte boundary, so a memory mapped
+// file can be restored with one memcpy per array (or viewed in place).
+// Bump snapshotVersion whenever the layout changes.
+
+namespace {
+
+const char snapshotMagic[8] = {'K', 'A', 'I', 'J', 'U', 'G', 'R', 'D'};
+const uint32_t snapshotVersion = 1;
+const uint32_t snapshotByteOrder = 0x01020304;
+
+class SnapshotWriter {
+public:
+    std::string data;
+
+    template <class T> void put(const T & value){
+        data.append((const char *)&value, sizeof(T));
+    }
+
+    void putBool(bool value){
+        put<uint8_t>(value);
+    }
+
+    template <class T> void putVector(const std::vector<T> & values){
+        put<uint64_t>(values.size());
+        pad();
+        if (!values.empty()){
+            data.append((const char *)values.data(), values.size()*sizeof(T));
+        }
+        pad();
+    }
+
+    void putVector(const std::vector<long> & values){
+        // long isn't 8 bytes everywhere (and may be int64_t itself)
+        putVector(std::vector<long long>(values.begin(), values.end()));
+    }
+
+    void putVector(const std::vector<bool> & values){
+        // not contiguous, one byte each
+        putVector(std::vector<uint8_t>(values.begin(), values.end()));
+    }
+
+    void putString(const std::string & value){
+        putVector(std::vector<char>(value.begin(), value.end()));
+    }
+
+    void putStream(const StreamSimplifier & stream){
+        put(stream.epsilon);
+        put<int32_t>(stream.nOpen);
+        put(stream.anchor);
+        put(stream.last);
+        put(stream.minSlope);
+        put(stream.maxSlope);
+    }
+
+private:
+    void pad(){
+        data.append((8 - data.size() % 8) % 8, '\0');
+    }
+};
+
+class SnapshotReader {
+public:
+    SnapshotReader(const char * data, size_t size) : begin(data), pos(data), end(data + size) {}
+
+    template <class T> T get(){
+        T value;
+        take(&value, sizeof(T));
+        return value;
+    }
+
+    bool getBool(){
+        return get<uint8_t>() != 0;
+    }
+
+    template <class T> void getVector(std::vector<T> & values){
+        uint64_t size = get<uint64_t>();
+        pad();
+        if (size > (uint64_t)(end - pos) / sizeof(T)){
+            throw std::runtime_error("Snapshot is truncated");
+        }
+        values.resize(size);
+        take(values.data(), size*sizeof(T));
+        pad();
+    }
+
+    void getVector(std::vector<long> & values){
+        std::vector<long long> stored;
+        getVector(stored);
+        values.assign(stored.begin(), stored.end());
+    }
+
+    void getVector(std::vector<bool> & values){
+        std::vector<uint8_t> stored;
+        getVector(stored);
+        values.assign(stored.begin(), stored.end());
+    }
+
+    std::string getString(){
+        std::vector<char> stored;
+        getVector(stored);
+        return std::string(stored.begin(), stored.end());
+    }
+
+    void getStream(StreamSimplifier & stream){
+        stream.epsilon = get<double>();
+        stream.nOpen = get<int32_t>();
+        stream.anchor = get<vec2>();
+        stream.last = get<vec2>();
+        stream.minSlope = get<double>();
+        stream.maxSlope = get<double>();
+    }
+
+    bool atEnd(){
+        return pos == end;
+    }
+
+private:
+    const char * begin;
+    const char * pos;
+    const char * end;
+
+    void take(void * out, size_t size){
+        if (size > (size_t)(end - pos)){
+            throw std::runtime_error("Snapshot is truncated");
+        }
+        if (size > 0){
+            memcpy(out, pos, size);
+        }
+        pos += size;
+    }
+
+    void pad(){
+        size_t extra = (8 - (pos - begin) % 8) % 8;
+        if (extra > (size_t)(end - pos)){
+            throw std::runtime_error("Snapshot is truncated");
+        }
+        pos += extra;
+    }
+};
+
+// every path a robot keeps, in snapshot order
+std::vector<std::vector<vec2> Robot::*> robotPaths(){
+    return {
+        &Robot::alphaPath, &Robot::betaPath,
+        &Robot::roughAlphaX, &Robot::roughAlphaY, &Robot::roughBetaX, &Robot::roughBetaY,
+        &Robot::smoothedAlphaPath, &Robot::smoothedBetaPath,
+        &Robot::simplifiedAlphaPath, &Robot::simplifiedBetaPath,
+        &Robot::interpSimplifiedAlphaPath, &Robot::interpSimplifiedBetaPath,
+        &Robot::interpAlphaX, &Robot::interpAlphaY, &Robot::interpBetaX, &Robot::interpBetaY,
+        &Robot::interpCollisions, &Robot::retimedAlphaPath, &Robot::retimedBetaPath
+    };
+}
+
+} // namespace
+
+std::string RobotGrid::snapshot() const {
+    SnapshotWriter out;
+    out.data.append(snapshotMagic, sizeof(snapshotMagic));
+    out.put(snapshotVersion);
+    out.put(snapshotByteOrder);
+
+    // constructor arguments first
+    out.put(angStep);
+    out.put(collisionBuffer);
+    out.put(epsilon);
+    out.put<int32_t>(seed);
+
+    out.put<int32_t>(algType);
+    out.put<int32_t>(nRobots);
+    out.put(greed);
+    out.put(phobia);
+    out.putBool(didFail);
+    out.put<int32_t>(nSteps);
+    out.put<int32_t>(maxPathSteps);
+    out.put<int32_t>(maxStepMultiplier);
+    out.put<int32_t>(nSweeps);
+    out.put<int64_t>(nStepCalls);
+    out.put<int64_t>(nMultiSteps);
+    out.putBool(useCostFields);
+    out.put(costFieldStep);
+    out.put<int32_t>(maxClusterAttempts);
+    out.put<int64_t>(maxClusterExpansions);
+    out.put<int64_t>(nClusterExpansions);
+    out.putBool(streamSimplify);
+    out.putBool(clearanceSimplify);
+    out.put<int32_t>(smoothCollisions);
+    out.putBool(initialized);
+    out.put(maxDisplacement);
+    out.putBool(skipClearChecks);
+    out.put<int64_t>(nSkippedChecks);
+    out.put<int64_t>(targetVersion);
+    out.put<int64_t>(conflictGraphVersion);
+    out.putVector(stepTimes);
+
+    out.put<uint64_t>(robotDict.size());
+    for (auto & rPair : robotDict){
+        const Robot & r = *rPair.second;
+        // geometry, as given to addRobot
+        out.put<int32_t>(r.id);
+        out.putString(r.holeID);
+        out.put(r.basePos);
+        out.put(r.iHat);
+        out.put(r.jHat);
+        out.put(r.kHat);
+        out.put(r.dxyz);
+        out.put(r.alphaLen);
+        out.put(r.alphaOffDeg);
+        out.put(r.betaOffDeg);
+        out.put(r.elementHeight);
+        out.put(r.scaleFac);
+        out.put(r.metBetaXY);
+        out.put(r.bossBetaXY);
+        out.put(r.apBetaXY);
+        out.put(r.collisionSegBetaXY);
+        out.put(r.angStep);
+        out.putBool(r.hasApogee);
+        // state
+        out.putBool(r.hasBoss);
+        out.put(r.xPos);
+        out.put(r.yPos);
+        out.put(r.minReach);
+        out.put(r.maxReach);
+        out.put(r.collisionBuffer);
+        out.put(r.clearance);
+        out.put(r.fiberReach);
+        out.put(r.alpha);
+        out.put(r.beta);
+        out.put(r.collisionSegWokXYZ);
+        out.put(r.metWokXYZ);
+        out.put(r.bossWokXYZ);
+        out.put(r.apWokXYZ);
+        out.putBool(r.hasDestinationAlphaBeta);
+        out.put(r.destinationAlpha);
+        out.put(r.destinationBeta);
+        out.put<int64_t>(r.assignedTargetID);
+        out.put<int32_t>(r.nDecollide);
+        out.put<int32_t>(r.lastStepNum);
+        out.put<int32_t>(r.clearUntilStep);
+        out.putBool(r.nudge);
+        out.putVector(r.robotNeighbors);
+        out.putVector(r.fiducialNeighbors);
+        out.putVector(r.validTargetIDs);
+        out.putVector(r.alphaVel);
+        out.putVector(r.betaVel);
+        out.putVector(r.smoothAlphaVel);
+        out.putVector(r.smoothBetaVel);
+        out.putVector(r.scoreVec);
+        for (auto path : robotPaths()){
+            out.putVector(r.*path);
+        }
+        out.putBool(r.streamPath);
+        out.putStream(r.alphaStream);
+        out.putStream(r.betaStream);
+        out.putBool(r.useCostField);
+        out.put(r.costFieldStep);
+        out.put<int32_t>(r.costFieldNAlpha);
+        out.put<int32_t>(r.costFieldNBeta);
+        out.put(r.costFieldAlpha);
+        out.put(r.costFieldBeta);
+        out.putVector(r.costField);
+        out.putVector(r.costFieldBlocked);
+    }
+
+    out.put<uint64_t>(fiducialDict.size());
+    for (auto & fPair : fiducialDict){
+        const Fiducial & f = *fPair.second;
+        out.put<int32_t>(f.id);
+        out.put(f.xyzWok);
+        out.put(f.collisionBuffer);
+        out.put(f.x);
+        out.put(f.y);
+    }
+
+    out.put<uint64_t>(targetDict.size());
+    for (auto & tPair : targetDict){
+        const Target & t = *tPair.second;
+        out.put<int64_t>(t.id);
+        out.put(t.xyzWok);
+        out.put<int32_t>(t.fiberType);
+        out.put<int32_t>(t.priority);
+        out.put(t.x);
+        out.put(t.y);
+        out.put(t.z);
+        out.put<int32_t>(t.assignedRobotID);
+        out.putVector(t.validRobotIDs);
+    }
+
+    out.putVector(nodeRobotIDs);
+    out.putVector(nodeTargetIDs);
+    out.putVector(conflictStart);
+    out.putVector(conflictNodes);
+    std::vector<int> firstNodeRobots, firstNodes;
+    for (auto & nPair : robotFirstNode){
+        firstNodeRobots.push_back(nPair.first);
+        firstNodes.push_back(nPair.second);
+    }
+    out.putVector(firstNodeRobots);
+    out.putVector(firstNodes);
+    return out.data;
+}
+
+void RobotGrid::restore(const char * data, size_t size){
+    // everything is read into a new grid, so a bad snapshot
+    // leaves this one untouched
+    SnapshotReader in(data, size);
+    char magic[sizeof(snapshotMagic)];
+    for (auto & c : magic){
+        c = in.get<char>();
+    }
+    if (memcmp(magic, snapshotMagic, sizeof(snapshotMagic)) != 0){
+        throw std::runtime_error("Not a RobotGrid snapshot");
+    }
+    uint32_t version = in.get<uint32_t>();
+    if (version > snapshotVersion){
+        throw std::runtime_error("Snapshot was written by a newer kaiju");
+    }
+    if (in.get<uint32_t>() != snapshotByteOrder){
+        throw std::runtime_error("Snapshot was written with a different byte order");
+    }
+
+    double newAngStep = in.get<double>();
+    double newCollisionBuffer = in.get<double>();
+    double newEpsilon = in.get<double>();
+    int newSeed = in.get<int32_t>();
+    RobotGrid grid(newAngStep, newCollisionBuffer, newEpsilon, newSeed);
+
+    grid.algType = (AlgType)in.get<int32_t>();
+    grid.nRobots = in.get<int32_t>();
+    grid.greed = in.get<double>();
+    grid.phobia = in.get<double>();
+    grid.didFail = in.getBool();
+    grid.nSteps = in.get<int32_t>();
+    grid.maxPathSteps = in.get<int32_t>();
+    grid.maxStepMultiplier = in.get<int32_t>();
+    grid.nSweeps = in.get<int32_t>();
+    grid.nStepCalls = in.get<int64_t>();
+    grid.nMultiSteps = in.get<int64_t>();
+    grid.useCostFields = in.getBool();
+    grid.costFieldStep = in.get<double>();
+    grid.maxClusterAttempts = in.get<int32_t>();
+    grid.maxClusterExpansions = in.get<int64_t>();
+    grid.nClusterExpansions = in.get<int64_t>();
+    grid.streamSimplify = in.getBool();
+    grid.clearanceSimplify = in.getBool();
+    grid.smoothCollisions = in.get<int32_t>();
+    grid.initialized = in.getBool();
+    grid.maxDisplacement = in.get<double>();
+    grid.skipClearChecks = in.getBool();
+    grid.nSkippedChecks = in.get<int64_t>();
+    grid.targetVersion = in.get<int64_t>();
+    grid.conflictGraphVersion = in.get<int64_t>();
+    in.getVector(grid.stepTimes);
+
+    uint64_t nStoredRobots = in.get<uint64_t>();
+    for (uint64_t ii = 0; ii < nStoredRobots; ii++){
+        int robotID = in.get<int32_t>();
+        std::string holeID = in.getString();
+        vec3 basePos = in.get<vec3>();
+        vec3 iHat = in.get<vec3>();
+        vec3 jHat = in.get<vec3>();
+        vec3 kHat = in.get<vec3>();
+        vec3 dxyz = in.get<vec3>();
+        double alphaLen = in.get<double>();
+        double alphaOffDeg = in.get<double>();
+        double betaOffDeg = in.get<double>();
+        double elementHeight = in.get<double>();
+        double scaleFac = in.get<double>();
+        vec2 metBetaXY = in.get<vec2>();
+        vec2 bossBetaXY = in.get<vec2>();
+        vec2 apBetaXY = in.get<vec2>();
+        auto collisionSegBetaXY = in.get<std::array<vec2, 2>>();
+        double robotAngStep = in.get<double>();
+        bool hasApogee = in.getBool();
+        auto r = std::make_shared<Robot>(
+            robotID, holeID, basePos, iHat, jHat,
+            kHat, dxyz, alphaLen, alphaOffDeg,
+            betaOffDeg, elementHeight, scaleFac, metBetaXY,
+            bossBetaXY, apBetaXY,
+            collisionSegBetaXY, robotAngStep,
+            hasApogee
+        );
+        r->hasBoss = in.getBool();
+        r->xPos = in.get<double>();
+        r->yPos = in.get<double>();
+        r->minReach = in.get<double>();
+        r->maxReach = in.get<double>();
+        r->collisionBuffer = in.get<double>();
+        r->clearance = in.get<double>();
+        r->fiberReach = in.get<double>();
+        r->alpha = in.get<double>();
+        r->beta = in.get<double>();
+        r->collisionSegWokXYZ = in.get<std::array<vec3, 2>>();
+        r->metWokXYZ = in.get<vec3>();
+        r->bossWokXYZ = in.get<vec3>();
+        r->apWokXYZ = in.get<vec3>();
+        r->hasDestinationAlphaBeta = in.getBool();
+        r->destinationAlpha = in.get<double>();
+        r->destinationBeta = in.get<double>();
+        r->assignedTargetID = in.get<int64_t>();
+        r->nDecollide = in.get<int32_t>();
+        r->lastStepNum = in.get<int32_t>();
+        r->clearUntilStep = in.get<int32_t>();
+        r->nudge = in.getBool();
+        in.getVector(r->robotNeighbors);
+        in.getVector(r->fiducialNeighbors);
+        in.getVector(r->validTargetIDs);
+        in.getVector(r->alphaVel);
+        in.getVector(r->betaVel);
+        in.getVector(r->smoothAlphaVel);
+        in.getVector(r->smoothBetaVel);
+        in.getVector(r->scoreVec);
+        for (auto path : robotPaths()){
+            in.getVector((*r).*path);
+        }
+        r->streamPath = in.getBool();
+        in.getStream(r->alphaStream);
+        in.getStream(r->betaStream);
+        r->useCostField = in.getBool();
+        r->costFieldStep = in.get<double>();
+        r->costFieldNAlpha = in.get<int32_t>();
+        r->costFieldNBeta = in.get<int32_t>();
+        r->costFieldAlpha = in.get<double>();
+        r->costFieldBeta = in.get<double>();
+        in.getVector(r->costField);
+        in.getVector(r->costFieldBlocked);
+        grid.robotDict[robotID] = r;
+    }
+
+    uint64_t nStoredFiducials = in.get<uint64_t>();
+    for (uint64_t ii = 0; ii < nStoredFiducials; ii++){
+        int fiducialID = in.get<int32_t>();
+        vec3 xyzWok = in.get<vec3>();
+        double fiducialBuffer = in.get<double>();
+        auto f = std::make_shared<Fiducial>(fiducialID, xyzWok, fiducialBuffer);
+        f->x = in.get<double>();
+        f->y = in.get<double>();
+        grid.fiducialDict[fiducialID] = f;
+    }
+
+    uint64_t nStoredTargets = in.get<uint64_t>();
+    for (uint64_t ii = 0; ii < nStoredTargets; ii++){
+        long targetID = in.get<int64_t>();
+        vec3 xyzWok = in.get<vec3>();
+        FiberType fiberType = (FiberType)in.get<int32_t>();
+        int priority = in.get<int32_t>();
+        auto t = std::make_shared<Target>(targetID, xyzWok, fiberType, priority);
+        t->x = in.get<double>();
+        t->y = in.get<double>();
+        t->z = in.get<double>();
+        t->assignedRobotID = in.get<int32_t>();
+        in.getVector(t->validRobotIDs);
+        grid.targetDict[targetID] = t;
+    }
+
+    in.getVector(grid.nodeRobotIDs);
+    in.getVector(grid.nodeTargetIDs);
+    in.getVector(grid.conflictStart);
+    in.getVector(grid.conflictNodes);
+    std::vector<int> firstNodeRobots, firstNodes;
+    in.getVector(firstNodeRobots);
+    in.getVector(firstNodes);
+    if (firstNodeRobots.size() != firstNodes.size()){
+        throw std::runtime_error("Snapshot is corrupt");
+    }
+    for (size_t ii = 0; ii < firstNodes.size(); ii++){
+        grid.robotFirstNode[firstNodeRobots[ii]] = firstNodes[ii];
+    }
+    if (!in.atEnd()){
+        throw std::runtime_error("Snapshot has trailing data");
+    }
+
+    // the reach index is derived, rebuild rather than store it
+    if (grid.initialized){
+        grid.buildReachCells();
+    }
+    *this = std::move(grid);
+}
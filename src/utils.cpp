@@ -1,4 +1,10 @@
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <algorithm>
+#include <limits>
 #include "utils.h"
 
 // vec2 test(){
@@ -42,6 +48,56 @@ vec3 multScalar3(vec3 & a, double scalar){
     return outVec;
 }
 
+void StreamSimplifier::reset(double newEpsilon){
+    if (newEpsilon < 0){
+        throw std::runtime_error("Cannot simplify, epsilon must be non-negative");
+    }
+    epsilon = newEpsilon;
+    nOpen = -1;
+}
+
+void StreamSimplifier::addPoint(const vec2 & point, std::vector<vec2> & out){
+    // sliding window (fan) simplification: the open segment runs from
+    // the anchor and may take any slope that passes within epsilon of
+    // every open point.  When the new point falls outside that range
+    // the previous point is kept and becomes the new anchor.
+    if (nOpen < 0){
+        // first point is always kept
+        out.push_back(point);
+        anchor = point;
+        last = point;
+        nOpen = 0;
+        minSlope = -std::numeric_limits<double>::infinity();
+        maxSlope = std::numeric_limits<double>::infinity();
+        return;
+    }
+    if (point[0] <= last[0]){
+        throw std::runtime_error("Stream points must have increasing x");
+    }
+    double dx = point[0] - anchor[0];
+    double slope = (point[1] - anchor[1]) / dx;
+    if (nOpen > 0 && (slope < minSlope || slope > maxSlope)){
+        out.push_back(last);
+        anchor = last;
+        nOpen = 0;
+        minSlope = -std::numeric_limits<double>::infinity();
+        maxSlope = std::numeric_limits<double>::infinity();
+        dx = point[0] - anchor[0];
+    }
+    minSlope = std::max(minSlope, (point[1] - epsilon - anchor[1]) / dx);
+    maxSlope = std::min(maxSlope, (point[1] + epsilon - anchor[1]) / dx);
+    last = point;
+    nOpen++;
+}
+
+void StreamSimplifier::finish(std::vector<vec2> & out){
+    if (nOpen > 0){
+        out.push_back(last);
+        anchor = last;
+        nOpen = 0;
+    }
+}
+
 double randomSample(){
     // return between 0 and 1
     return static_cast <double> (rand()) / static_cast <double> (RAND_MAX);
@@ -104,34 +160,48 @@ std::array<double, 2> sampleAnnulus(double rMin, double rMax){
 
 // create a linear interpolater
 double linearInterpolate(std::vector<vec2> & sparseXYPoints, double xValue){
-    vec2 pt1, pt0;
-    double yValue;
+    int cursor = 0;
+    return linearInterpolate(sparseXYPoints, xValue, cursor);
+}
+
+// interpolate starting the search at segment cursor, cursor is left on
+// the segment used, so a caller walking x upward through the sparse
+// points only ever moves forward (merge style).  The sparse points must
+// be sorted by x.  Outside of the sparse range the first segment is
+// extrapolated below, and the last y value is held above.
+double linearInterpolate(const std::vector<vec2> & sparseXYPoints, double xValue, int & cursor){
     int nPoints = sparseXYPoints.size();
-    // check that x is in range
-    // if (xValue < sparseXYPoints[0](0) || xValue > sparseXYPoints[nPoints-1](0)){
-    //     throw std::runtime_error("x outside interpolation range");
-    // }
-    if (xValue < sparseXYPoints[0][0]){
-        yValue = sparseXYPoints[0][1];
-        // constant extrapolation
+    if (nPoints == 0){
+        throw std::runtime_error("Cannot interpolate, no points");
     }
-
-    if (xValue > sparseXYPoints[nPoints-1][0]){
-        yValue = sparseXYPoints[nPoints-1][1];
+    if (cursor < 0 || cursor >= nPoints || xValue < sparseXYPoints[cursor][0]){
+        // moved backwards, restart from the beginning
+        cursor = 0;
     }
-    // check if x == last point
-    if (xValue == sparseXYPoints[nPoints-1][0]){
-        yValue = sparseXYPoints[nPoints-1][1];
+    while (cursor < nPoints-1 && !(xValue < sparseXYPoints[cursor+1][0])){
+        cursor++;
     }
-    for (int ii = 0; ii < nPoints-1; ii++){
-        pt1 = sparseXYPoints[ii+1];
-        pt0 = sparseXYPoints[ii];
-        if (xValue < pt1[0]){
-            yValue = pt0[1] + (pt1[1]-pt0[1]) / (pt1[0] - pt0[0]) * (xValue - pt0[0]);
-            break;
-        }
+    if (cursor == nPoints-1){
+        // at or beyond the last point (or only one point)
+        return sparseXYPoints[cursor][1];
+    }
+    const vec2 & pt0 = sparseXYPoints[cursor];
+    const vec2 & pt1 = sparseXYPoints[cursor+1];
+    return pt0[1] + (pt1[1]-pt0[1]) / (pt1[0] - pt0[0]) * (xValue - pt0[0]);
+}
+
+// interpolate a whole (sorted) array of x values in a single pass
+// through the sparse points
+void linearInterpolate(
+    const std::vector<vec2> & sparseXYPoints,
+    const std::vector<double> & xValues,
+    std::vector<double> & yValues
+){
+    int cursor = 0;
+    yValues.resize(xValues.size());
+    for (size_t ii = 0; ii < xValues.size(); ii++){
+        yValues[ii] = linearInterpolate(sparseXYPoints, xValues[ii], cursor);
     }
-    return yValue;
 }
 
 // http://geomalgorithms.com/a07-_distance.html#dist3D_Segment_to_Segment()
@@ -279,7 +349,8 @@ double dist3D_Point_to_Segment( vec3 Point, vec3 Seg_P0, vec3 Seg_P1)
     // this routine has some numerical instability
     // this probably insn't the best fix but it seems
     // to behave?
-    d1 = dot3(Point,Pb);
+    d = sub3(Point, Pb);
+    d1 = dot3(d,d);
     d2 = dot3(x,x);
     d3 = dot3(w,w);
     minDist = d1;
@@ -341,48 +412,81 @@ double PerpendicularDistance(const vec2 &pt, const vec2 &lineStart, const vec2 &
 }
 
 void RamerDouglasPeucker(const std::vector<vec2> &pointList, double epsilon, std::vector<vec2> &out)
-{   // biasDir is to modify the internal (not end) points by epsilon in one directon to make sure we are on one
-    // side of the curve
+{
+    // iterative version, index ranges waiting to be simplified are kept
+    // on a stack and the points to keep are marked in place, no sub
+    // lists are copied.  Gives the same points as the classic recursion.
     if(pointList.size()<2)
         throw std::runtime_error("Not enough points to simplify");
+    if(epsilon<0)
+        throw std::runtime_error("Cannot simplify, epsilon must be non-negative");
 
-    // Find the point with the maximum distance from line between start and end
-    double dmax = 0.0;
-    size_t index = 0;
-    size_t end = pointList.size()-1;
-    for(size_t i = 1; i < end; i++)
+    size_t nPoints = pointList.size();
+    std::vector<bool> keep(nPoints, false);
+    keep[0] = true;
+    keep[nPoints-1] = true;
+    std::vector<std::array<size_t, 2>> stack;
+    stack.push_back({0, nPoints-1});
+
+    while(stack.size() != 0)
     {
-        double d = PerpendicularDistance(pointList[i], pointList[0], pointList[end]);
-        if (d > dmax)
+        size_t start = stack.back()[0];
+        size_t end = stack.back()[1];
+        stack.pop_back();
+        if(end - start < 2)
+            continue;
+
+        // normalized line direction, once per range (as PerpendicularDistance)
+        const vec2 &lineStart = pointList[start];
+        double dx = pointList[end][0] - lineStart[0];
+        double dy = pointList[end][1] - lineStart[1];
+        double mag = pow(pow(dx,2.0)+pow(dy,2.0),0.5);
+        if(mag > 0.0)
         {
-            index = i;
-            dmax = d;
+            dx /= mag; dy /= mag;
         }
-    }
 
-    // If max distance is greater than epsilon, recursively simplify
-    if(dmax > epsilon)
-    {
-        // Recursive call
-        std::vector<vec2> recResults1;
-        std::vector<vec2> recResults2;
-        std::vector<vec2> firstLine(pointList.begin(), pointList.begin()+index+1);
-        std::vector<vec2> lastLine(pointList.begin()+index, pointList.end());
-        RamerDouglasPeucker(firstLine, epsilon, recResults1);
-        RamerDouglasPeucker(lastLine, epsilon, recResults2);
-
-        // Build the result list
-        out.assign(recResults1.begin(), recResults1.end()-1);
-        out.insert(out.end(), recResults2.begin(), recResults2.end());
-        if(out.size()<2)
-            throw std::runtime_error("Problem assembling output");
+        // Find the point with the maximum distance from the line, squared
+        // distances are compared and the root only taken for a new
+        // maximum (so ties that round together in the root still keep
+        // the first index, like the recursive version did)
+        double dmax2 = 0.0;
+        double dmax = 0.0;
+        size_t index = start;
+        for(size_t i = start+1; i < end; i++)
+        {
+            double pvx = pointList[i][0] - lineStart[0];
+            double pvy = pointList[i][1] - lineStart[1];
+            double pvdot = dx * pvx + dy * pvy;
+            double ax = pvx - pvdot * dx;
+            double ay = pvy - pvdot * dy;
+            double d2 = ax*ax + ay*ay;
+            if (d2 > dmax2)
+            {
+                dmax2 = d2;
+                double d = sqrt(d2);
+                if (d > dmax)
+                {
+                    index = i;
+                    dmax = d;
+                }
+            }
+        }
+
+        // If max distance is greater than epsilon, split there
+        if(dmax > epsilon)
+        {
+            keep[index] = true;
+            stack.push_back({start, index});
+            stack.push_back({index, end});
+        }
     }
-    else
+
+    out.clear();
+    for(size_t i = 0; i < nPoints; i++)
     {
-        //Just return start and end points
-        out.clear();
-        out.push_back(pointList[0]);
-        out.push_back(pointList[end]);
+        if(keep[i])
+            out.push_back(pointList[i]);
     }
 }
 
@@ -403,5 +507,49 @@ void RamerDouglasPeucker(const std::vector<vec2> &pointList, double epsilon, std
 //     return mean;
 // }
 
-
-
+void parallelFor(int nItems, int nThreads, const std::function<void(int)> & func){
+    // call func(ii) for ii in [0, nItems) spread over nThreads threads
+    // (nThreads < 1 uses every core), each thread takes the next
+    // unclaimed item.  func must only touch state owned by its item.
+    // The first exception thrown by func is rethrown here once all
+    // threads are done
+    if (nThreads < 1){
+        nThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+    }
+    nThreads = std::min(nThreads, nItems);
+    if (nThreads <= 1){
+        for (int ii=0; ii<nItems; ii++){
+            func(ii);
+        }
+        return;
+    }
+    std::atomic<int> nextItem(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto worker = [&](){
+        int ii;
+        while (!failed && (ii = nextItem++) < nItems){
+            try {
+                func(ii);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error){
+                    error = std::current_exception();
+                }
+                failed = true;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int ii=0; ii<nThreads; ii++){
+        threads.push_back(std::thread(worker));
+    }
+    for (auto & thread : threads){
+        thread.join();
+    }
+    if (error){
+        std::rethrow_exception(error);
+    }
+}
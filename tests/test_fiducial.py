@@ -40,11 +40,30 @@ def test_fiducial(plot=False):
         if plot:
             utils.plotOne(0, rg, figname="fiducial_%i.png"%betaAng, isSequence=False, xlim=[-30, 30], ylim=[-30, 30])
 
-        # assert len(rColliders) == 0
-        # if betaAng < 14:
-        #     assert fColliders == [fiducialID]
-        # else:
-        #     assert len(fColliders) == 0
+        assert len(rColliders) == 0
+        if betaAng < 14:
+            assert fColliders == [fiducialID]
+        else:
+            assert len(fColliders) == 0
+
+def test_fiducialBesideSegment():
+    # distance is to the closest point along the collision segment,
+    # not just its ends
+    collisionBuffer = 2
+    fiducialCollisionBuffer = 1.5
+    robotID = 1
+    z = coordio.defaults.POSITIONER_HEIGHT
+    for offset, collides in [(3, True), (4, False)]:
+        rg = RobotGrid(1, collisionBuffer, 2, 0)
+        rg.addRobot(robotID, str(robotID), [0, 0, 0], True)
+        # segment runs along +x from the beta axis at alpha=90, beta=0
+        rg.addFiducial(1, [14.5, offset, z], fiducialCollisionBuffer)
+        # and the fiducial is just off the segment's far end
+        rg.addFiducial(2, [23, 0, z], fiducialCollisionBuffer)
+        rg.initGrid()
+        rg.getRobot(robotID).setAlphaBeta(90, 0)
+        expect = [1, 2] if collides else [2]
+        assert rg.fiducialColliders(robotID) == expect
 
 def grow(plot=False):
     angStep = 1
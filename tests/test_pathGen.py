@@ -2,6 +2,8 @@ import pytest
 import numpy
 import time
 
+import coordio
+
 from kaiju.robotGrid import RobotGrid, RobotGridAPO
 from kaiju import utils
 
@@ -121,6 +123,576 @@ def test_pathGen(plot=False):
 #     assert not rg.didFail
 
 
+def test_clearanceSkipping():
+    # skipping checks for robots with large clearance must not
+    # change the paths generated
+    xPos, yPos = utils.hexFromDia(15, pitch=22.4)
+    paths = []
+    for skip in [False, True]:
+        rg = RobotGrid(0.5, 2, seed=4)
+        rg.skipClearChecks = skip
+        for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+            rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+            rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+        rg.initGrid()
+        for rID in rg.robotDict:
+            rg.getRobot(rID).setXYUniform()
+        rg.decollideGrid()
+        rg.pathGenGreedy()
+        if skip:
+            assert rg.nSkippedChecks > 0
+        else:
+            assert rg.nSkippedChecks == 0
+        paths.append([rg.robotDict[rID].alphaPath for rID in rg.robotDict])
+    for p1, p2 in zip(*paths):
+        assert numpy.array_equal(p1, p2)
+
+
+def test_adaptiveStep():
+    # clear robots may take several steps per sweep, but
+    # paths must stay on the common step timeline
+    xPos, yPos = utils.hexFromDia(9, pitch=22.4)
+    angStep = 0.5
+    for maxStepMultiplier in [1, 8]:
+        rg = RobotGrid(angStep, 2, seed=4)
+        rg.maxStepMultiplier = maxStepMultiplier
+        for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+            rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+            rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+        rg.initGrid()
+        for rID in rg.robotDict:
+            rg.getRobot(rID).setXYUniform()
+        rg.decollideGrid()
+        rg.pathGenGreedy()
+        assert not rg.didFail
+        if maxStepMultiplier == 1:
+            assert rg.nMultiSteps == 0
+            assert rg.nStepCalls == len(rg.robotDict) * rg.nSteps
+        else:
+            # some robots moved several steps per sweep, so fewer
+            # moves were chosen than robots x steps
+            assert rg.nMultiSteps > 0
+            assert rg.nStepCalls < len(rg.robotDict) * rg.nSteps
+        robotIDs = list(rg.robotDict.keys())
+        alphas = []
+        betas = []
+        for robotID in robotIDs:
+            robot = rg.robotDict[robotID]
+            alphaPath = numpy.array(robot.alphaPath)
+            betaPath = numpy.array(robot.betaPath)
+            assert len(alphaPath) == rg.nSteps
+            assert numpy.array_equal(alphaPath[:, 0], numpy.arange(rg.nSteps))
+            assert numpy.max(numpy.abs(numpy.diff(alphaPath[:, 1]))) <= angStep + 1e-9
+            assert numpy.max(numpy.abs(numpy.diff(betaPath[:, 1]))) <= angStep + 1e-9
+            assert alphaPath[-1, 1] == 0 and betaPath[-1, 1] == 180
+            alphas.append(alphaPath[:, 1])
+            betas.append(betaPath[:, 1])
+        stepCollisions = rg.verifyTrajectories(
+            robotIDs, numpy.array(alphas), numpy.array(betas)
+        )[0]
+        assert sum(stepCollisions) == 0
+
+
+def test_smoothVelocity():
+    # the running window smoother is a symmetric moving average of
+    # the step velocities, with a full speed lead in and a zero tail
+    xPos, yPos = utils.hexFromDia(7, pitch=22.4)
+    angStep = 0.5
+    rg = RobotGrid(angStep, 1.5, seed=1)
+    for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+        rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+        rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+    rg.initGrid()
+    for rID in rg.robotDict:
+        rg.getRobot(rID).setXYUniform()
+    rg.decollideGrid()
+    rg.pathGenGreedy()
+    points = 7
+    rg.smoothPaths(points)
+    kernel = numpy.ones(2*points - 1) / (2*points - 1)
+    for robot in rg.robotDict.values():
+        for path, smoothed, lead in [
+            (robot.alphaPath, robot.smoothedAlphaPath, -angStep),
+            (robot.betaPath, robot.smoothedBetaPath, angStep)
+        ]:
+            path = numpy.array(path)[:, 1]
+            vel = numpy.hstack((numpy.diff(path), numpy.zeros(400)))
+            buffered = numpy.hstack(([lead]*points, vel, [vel[-1]]*points))
+            smoothVel = numpy.convolve(buffered, kernel, mode="valid")[1:-1]
+            expect = numpy.hstack(
+                (path[0], path[0] + numpy.cumsum(smoothVel), path[-1])
+            )
+            smoothed = numpy.array(smoothed)
+            assert numpy.array_equal(smoothed[:, 0], numpy.arange(len(expect)))
+            assert numpy.allclose(smoothed[:, 1], expect, rtol=0, atol=1e-9)
+
+
+def test_tiledPathGen():
+    # tiles of one color are stepped in parallel, every robot takes
+    # one step per sweep against its neighbors' current poses
+    xPos, yPos = utils.hexFromDia(15, pitch=22.4)
+    angStep = 1
+    rg = RobotGrid(angStep, 1.5, seed=2)
+    for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+        rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+        rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+    rg.initGrid()
+    for rID in rg.robotDict:
+        rg.getRobot(rID).setXYUniform()
+    rg.decollideGrid()
+    robotIDs = list(rg.robotDict.keys())
+    starts = [(rg.robotDict[rID].alpha, rg.robotDict[rID].beta) for rID in robotIDs]
+
+    def resetStarts():
+        for rID, (alpha, beta) in zip(robotIDs, starts):
+            rg.robotDict[rID].setAlphaBeta(alpha, beta)
+
+    rg.pathGenTiled(100, nThreads=2)
+    for robot in rg.robotDict.values():
+        alphaPath = numpy.array(robot.alphaPath)
+        betaPath = numpy.array(robot.betaPath)
+        assert numpy.array_equal(alphaPath[:, 0], numpy.arange(rg.nSteps))
+        assert numpy.max(numpy.abs(numpy.diff(alphaPath[:, 1]))) <= angStep + 1e-9
+        assert numpy.max(numpy.abs(numpy.diff(betaPath[:, 1]))) <= angStep + 1e-9
+    stuck = [r for r in rg.robotDict.values() if r.score() != 0]
+    assert rg.didFail == (len(stuck) > 0)
+    alphas = numpy.array([rg.robotDict[rID].alphaPath[:, 1] for rID in robotIDs])
+    betas = numpy.array([rg.robotDict[rID].betaPath[:, 1] for rID in robotIDs])
+    stepCollisions = rg.verifyTrajectories(robotIDs, alphas, betas)[0]
+    assert sum(stepCollisions) == 0
+
+    # the plan doesn't depend on the thread count
+    resetStarts()
+    rg.pathGenTiled(100, nThreads=1)
+    alphas1 = numpy.array([rg.robotDict[rID].alphaPath[:, 1] for rID in robotIDs])
+    assert numpy.array_equal(alphas1, alphas)
+
+    # paths can be simplified as they are generated
+    resetStarts()
+    rg.streamSimplify = True
+    rg.pathGenTiled(100, nThreads=2)
+    for robot in rg.robotDict.values():
+        assert len(robot.alphaPath) == 0
+        assert robot.simplifiedAlphaPath[-1].tolist() == [rg.nSteps - 1, robot.alpha]
+    rg.streamSimplify = False
+
+    with pytest.raises(RuntimeError):
+        rg.pathGenTiled(0)
+    # tiles narrower than the neighbor distance would let
+    # neighbors step at the same time
+    with pytest.raises(RuntimeError):
+        rg.pathGenTiled(30)
+    rg.maxStepMultiplier = 4
+    with pytest.raises(RuntimeError):
+        rg.pathGenTiled(100)
+
+
+def test_resolveDeadlocks():
+    # unjam deadlocked clusters locally after a failed path gen,
+    # the fixes are appended to everyone's paths
+    xPos, yPos = utils.hexFromDia(15, pitch=22.4)
+    nFailed = 0
+    for seed in range(5):
+        rg = RobotGrid(1, 2, seed=seed)
+        for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+            rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+            rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+        rg.initGrid()
+        for rID in rg.robotDict:
+            rg.getRobot(rID).setXYUniform()
+        rg.decollideGrid()
+        rg.pathGenGreedy()
+        if not rg.didFail:
+            continue
+        nFailed += 1
+        nStuck = len([r for r in rg.robotDict.values() if r.score() != 0])
+        nSteps = rg.nSteps
+        nSolved = rg.resolveDeadlocks()
+        stuck = [r.id for r in rg.robotDict.values() if r.score() != 0]
+        assert rg.didFail == (len(stuck) > 0)
+        if nSolved > 0:
+            assert len(stuck) < nStuck
+            assert rg.nSteps > nSteps
+        for robot in rg.robotDict.values():
+            alphaPath = numpy.array(robot.alphaPath)
+            assert numpy.array_equal(alphaPath[:, 0], numpy.arange(rg.nSteps))
+        # the appended steps, from the last planned pose on, never collide
+        robotIDs = list(rg.robotDict.keys())
+        alphas = numpy.array([rg.robotDict[rID].alphaPath[nSteps-1:, 1] for rID in robotIDs])
+        betas = numpy.array([rg.robotDict[rID].betaPath[nSteps-1:, 1] for rID in robotIDs])
+        stepCollisions = rg.verifyTrajectories(robotIDs, alphas, betas)[0]
+        assert sum(stepCollisions) == 0
+
+        # a cluster that can't be solved stops at the expansion budget
+        rg.maxClusterExpansions = 2000
+        for cluster in rg.deadlockedClusters():
+            rg.solveCluster(cluster)
+            assert rg.nClusterExpansions <= rg.maxClusterExpansions
+    assert nFailed > 0
+
+
+def test_costField():
+    # the straight line to the destination runs through a fiducial,
+    # the cost to go field steers the robot around it
+    rg = RobotGrid(1, 2, seed=0)
+    rg.useCostFields = True
+    rg.addRobot(0, "0", [0, 0, 0], hasApogee)
+    rg.addFiducial(0, [11, 0, coordio.defaults.POSITIONER_HEIGHT])
+    rg.initGrid()
+    robot = rg.getRobot(0)
+    robot.setAlphaBeta(330, 160)
+    assert not rg.isCollided(0)
+    robot.setDestinationAlphaBeta(330, 40)
+    rg.pathGenGreedy()
+    assert robot.useCostField
+    assert not rg.didFail
+    assert robot.costToGo() < 1
+
+
+def test_verifyTrajectories():
+    # bulk collision checks of alpha/beta trajectories agree with
+    # verifySmoothed and leave the robots where they are
+    xPos, yPos = utils.hexFromDia(15, pitch=22.4)
+    rg = RobotGrid(1, 2.5, seed=1)
+    for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+        rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+        rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+    rg.initGrid()
+    for rID in rg.robotDict:
+        rg.getRobot(rID).setXYUniform()
+    rg.decollideGrid()
+    rg.pathGenGreedy()
+    rg.smoothPaths(3)
+    rg.simplifyPaths()
+    rg.verifySmoothed()
+
+    robotIDs = list(rg.robotDict.keys())
+    alphas = numpy.array([
+        numpy.array(rg.robotDict[rID].interpSimplifiedAlphaPath)[:rg.nSteps, 1]
+        for rID in robotIDs
+    ])
+    betas = numpy.array([
+        numpy.array(rg.robotDict[rID].interpSimplifiedBetaPath)[:rg.nSteps, 1]
+        for rID in robotIDs
+    ])
+    poses = [(r.alpha, r.beta) for r in rg.robotDict.values()]
+    stepCollisions, robotPairs, fiducialPairs, firstStep = rg.verifyTrajectories(
+        robotIDs, alphas, betas, nThreads=2
+    )
+    assert poses == [(r.alpha, r.beta) for r in rg.robotDict.values()]
+    assert len(stepCollisions) == rg.nSteps
+    assert sum(stepCollisions) == rg.smoothCollisions
+    assert len(fiducialPairs) == 0
+    if rg.smoothCollisions == 0:
+        assert firstStep == -1
+    else:
+        assert firstStep == numpy.nonzero(stepCollisions)[0][0]
+        assert robotPairs[0][0] == firstStep
+
+    # drive one robot's beta arm into its folded neighbors
+    robot = rg.robotDict[0]
+    robot.setAlphaBeta(0, 180)
+    for rID in robot.robotNeighbors:
+        rg.robotDict[rID].setAlphaBeta(0, 180)
+    steps = numpy.arange(0, 360, 5.0)
+    stepCollisions, robotPairs, fiducialPairs, firstStep = rg.verifyTrajectories(
+        [0], steps[None, :], numpy.zeros((1, len(steps)))
+    )
+    assert firstStep != -1
+    assert sum(stepCollisions) > 0
+    assert all(0 in pair[1:] for pair in robotPairs)
+    assert rg.robotDict[0].alpha == 0 and rg.robotDict[0].beta == 180
+
+    with pytest.raises(RuntimeError):
+        rg.verifyTrajectories([0, 0], numpy.zeros((2, 3)), numpy.zeros((2, 3)))
+    with pytest.raises(RuntimeError):
+        rg.verifyTrajectories([0], numpy.zeros((1, 3)), numpy.zeros((1, 4)))
+
+
+def test_parallelSmoothSimplify():
+    # threaded post processing gives the serial answer
+    xPos, yPos = utils.hexFromDia(15, pitch=22.4)
+    grids = []
+    for nThreads in [1, 4]:
+        rg = RobotGrid(1, 2.5, seed=3)
+        for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+            rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+            rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+        rg.initGrid()
+        for rID in rg.robotDict:
+            rg.getRobot(rID).setXYUniform()
+        rg.decollideGrid()
+        rg.pathGenGreedy()
+        rg.smoothPaths(3, nThreads=nThreads)
+        rg.simplifyPaths(nThreads=nThreads)
+        rg.verifySmoothed(nThreads=nThreads)
+        grids.append(rg)
+    assert grids[0].smoothCollisions == grids[1].smoothCollisions
+    for rID in grids[0].robotDict:
+        r1 = grids[0].robotDict[rID]
+        r2 = grids[1].robotDict[rID]
+        assert numpy.array_equal(r1.simplifiedAlphaPath, r2.simplifiedAlphaPath)
+        assert numpy.array_equal(r1.interpSimplifiedBetaPath, r2.interpSimplifiedBetaPath)
+        assert numpy.array_equal(r1.interpAlphaX, r2.interpAlphaX)
+        assert numpy.array_equal(r1.interpBetaY, r2.interpBetaY)
+        assert (r1.alpha, r1.beta) == (r2.alpha, r2.beta)
+
+
+def test_tuneSimplification():
+    # find the sparsest collision free smoothing, planned with a bigger
+    # buffer than the one verified against like test_pathGen
+    xPos, yPos = utils.hexFromDia(15, pitch=22.4)
+    rg = RobotGrid(1, 2.5, seed=0)
+    for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+        rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+        rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+    rg.initGrid()
+    for rID in rg.robotDict:
+        rg.getRobot(rID).setXYUniform()
+    rg.decollideGrid()
+    rg.pathGenGreedy()
+    rg.setCollisionBuffer(2)
+    points, epsilon = rg.tuneSimplification([3, 5], 0, 6, tolerance=0.1)
+    assert points in [3, 5]
+    assert 0 <= epsilon <= 6
+    assert rg.epsilon == epsilon
+    assert len(rg.robotDict[0].interpSimplifiedAlphaPath) == rg.nSteps
+    if epsilon > 0:
+        assert rg.smoothCollisions == 0
+    nCollisions = rg.smoothCollisions
+    rg.verifySmoothed()
+    assert rg.smoothCollisions == nCollisions
+
+    with pytest.raises(RuntimeError):
+        rg.tuneSimplification([3], 2, 1)
+
+
+def test_clearanceSimplify():
+    # simplified paths kept within the rough paths' clearance can't
+    # collide, even with a large epsilon
+    xPos, yPos = utils.hexFromDia(15, pitch=22.4)
+    rg = RobotGrid(1, 2.5, seed=0)
+    for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+        rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+        rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+    rg.initGrid()
+    for rID in rg.robotDict:
+        rg.getRobot(rID).setXYUniform()
+    rg.decollideGrid()
+    rg.pathGenGreedy()
+    rg.smoothPaths(3)
+    rg.epsilon = 2
+    rg.clearanceSimplify = True
+    rg.simplifyPaths()
+    rg.verifySmoothed()
+    assert rg.smoothCollisions == 0
+
+    clearances = rg.roughClearances()
+    assert len(clearances) == len(rg.robotDict)
+    assert all(len(c) == rg.nSteps for c in clearances)
+    assert numpy.min(clearances) >= 0
+
+
+def test_failedMDPClearances():
+    # a failed MDP path gen counts one step past the recorded paths,
+    # clearances and tuning only use the recorded steps
+    xPos, yPos = utils.hexFromDia(15, pitch=22.4)
+    rg = RobotGrid(1, 2.5, seed=0)
+    for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+        rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+        rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+    rg.initGrid()
+    for rID in rg.robotDict:
+        rg.getRobot(rID).setXYUniform()
+    rg.decollideGrid()
+    rg.pathGenMDP(0.8, 0.1)
+    assert rg.didFail
+    nPathSteps = len(rg.robotDict[0].alphaPath)
+    assert nPathSteps < rg.nSteps
+
+    clearances = rg.roughClearances()
+    assert all(len(c) == nPathSteps for c in clearances)
+    assert numpy.min(clearances) >= 0
+    rg.smoothPaths(3)
+    rg.epsilon = 2
+    rg.clearanceSimplify = True
+    rg.simplifyPaths()
+    rg.verifySmoothed()
+    assert rg.smoothCollisions == 0
+
+    rg.clearanceSimplify = False
+    points, epsilon = rg.tuneSimplification([3], 0, 4, tolerance=0.5)
+    assert points == 3
+    assert 0 <= epsilon <= 4
+
+
+def test_streamSimplify():
+    # paths simplified as they are generated keep only sparse points
+    xPos, yPos = utils.hexFromDia(15, pitch=22.4)
+    rg = RobotGrid(1, 2.5, seed=0)
+    for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+        rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+        rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+    rg.initGrid()
+    for rID in rg.robotDict:
+        rg.getRobot(rID).setXYUniform()
+    rg.decollideGrid()
+    rg.streamSimplify = True
+    rg.pathGenGreedy()
+    for robot in rg.robotDict.values():
+        assert len(robot.alphaPath) == 0
+        assert len(robot.simplifiedAlphaPath) < rg.nSteps / 10
+        assert robot.simplifiedAlphaPath[0][0] == 0
+        assert robot.simplifiedAlphaPath[-1].tolist() == [rg.nSteps - 1, robot.alpha]
+        assert robot.simplifiedBetaPath[-1].tolist() == [rg.nSteps - 1, robot.beta]
+    with pytest.raises(RuntimeError):
+        rg.smoothPaths(3)
+    # passes over the dense paths say why they can't run
+    for denseOnly in [
+        lambda: rg.roughClearances(),
+        lambda: rg.tuneSimplification([3], 0, 4),
+        lambda: rg.shortcutPaths(),
+    ]:
+        with pytest.raises(RuntimeError) as excinfo:
+            denseOnly()
+        assert "simplified during path gen" in str(excinfo.value)
+    rg.simplifyPaths()
+    rg.verifySmoothed()
+    for robot in rg.robotDict.values():
+        assert len(robot.interpSimplifiedAlphaPath) == rg.nSteps
+
+
+def test_retimePaths():
+    # a shared time warp of the step clock within the speed and
+    # acceleration limits, passing through the same poses, and faster
+    # than the clock when acceleration is free
+    xPos, yPos = utils.hexFromDia(15, pitch=22.4)
+    rg = RobotGrid(1, 2.5, seed=0)
+    for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+        rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+        rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+    rg.initGrid()
+    for rID in rg.robotDict:
+        rg.getRobot(rID).setXYUniform()
+    rg.decollideGrid()
+    rg.pathGenGreedy()
+    rg.smoothPaths(3)
+    rg.simplifyPaths()
+    speed = 30
+    accel = 60
+    fastTime = rg.retimePaths(speed, speed, 1e6, 1e6)
+    assert fastTime < (len(rg.stepTimes) - 1) * rg.angStep / speed
+    moveTime = rg.retimePaths(speed, speed, accel, accel)
+    assert moveTime > fastTime
+    stepTimes = numpy.array(rg.stepTimes)
+    assert moveTime == stepTimes[-1]
+    assert numpy.all(numpy.diff(stepTimes) >= 0)
+    for robot in rg.robotDict.values():
+        for path, simplified in [
+            (robot.retimedAlphaPath, robot.simplifiedAlphaPath),
+            (robot.retimedBetaPath, robot.simplifiedBetaPath)
+        ]:
+            path = numpy.array(path)
+            simplified = numpy.array(simplified)
+            dt = numpy.diff(path[:, 0])
+            assert numpy.all(dt > 0)
+            vel = numpy.diff(path[:, 1]) / dt
+            assert numpy.max(numpy.abs(vel)) <= speed + 1e-6
+            # speeds sit at segment midpoints, from and to rest
+            vel = numpy.concatenate([[0], vel, [0]])
+            halfDt = numpy.concatenate([[0], dt / 2, [0]])
+            acc = numpy.diff(vel) / (halfDt[:-1] + halfDt[1:])
+            assert numpy.max(numpy.abs(acc)) <= accel + 1e-6
+            steps = numpy.arange(len(stepTimes))
+            assert numpy.allclose(
+                numpy.interp(stepTimes, path[:, 0], path[:, 1]),
+                numpy.interp(steps, simplified[:, 0], simplified[:, 1])
+            )
+
+    with pytest.raises(RuntimeError):
+        rg.retimePaths(0, speed, 60, 60)
+
+    # a new simplification or plan drops the old timing
+    rg.simplifyPaths()
+    assert len(rg.stepTimes) == 0
+    for robot in rg.robotDict.values():
+        assert len(robot.retimedAlphaPath) == len(robot.retimedBetaPath) == 0
+    rg.retimePaths(speed, speed, accel, accel)
+    rg.pathGenGreedy()
+    assert len(rg.stepTimes) == 0
+    for robot in rg.robotDict.values():
+        assert len(robot.retimedAlphaPath) == len(robot.retimedBetaPath) == 0
+
+
+def test_shortcutPaths():
+    # jiggly MDP paths get shorter without new collisions, ends are kept
+    xPos, yPos = utils.hexFromDia(15, pitch=22.4)
+    rg = RobotGrid(1, 2.5, seed=0)
+    for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+        rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+        rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+    rg.initGrid()
+    for rID in rg.robotDict:
+        rg.getRobot(rID).setXYUniform()
+    rg.decollideGrid()
+    rg.pathGenMDP(0.8, 0.1)
+
+    def travel():
+        total = 0
+        for robot in rg.robotDict.values():
+            total += numpy.sum(numpy.abs(numpy.diff(numpy.array(robot.alphaPath)[:, 1])))
+            total += numpy.sum(numpy.abs(numpy.diff(numpy.array(robot.betaPath)[:, 1])))
+        return total
+
+    def nCollisions():
+        nCollide = 0
+        nPathSteps = len(rg.robotDict[0].alphaPath)
+        for step in range(nPathSteps):
+            for robot in rg.robotDict.values():
+                robot.setAlphaBeta(robot.alphaPath[step][1], robot.betaPath[step][1])
+            nCollide += rg.getNCollisions()
+        return nCollide
+
+    def ends():
+        return [(r.alphaPath[[0, -1]].tolist(), r.betaPath[[0, -1]].tolist()) for r in rg.robotDict.values()]
+
+    ends0 = ends()
+    travel0 = travel()
+    collisions0 = nCollisions()
+    assert rg.shortcutPaths(2000, nThreads=2) > 0
+    assert travel() < travel0
+    assert nCollisions() <= collisions0
+    assert ends() == ends0
+    for robot in rg.robotDict.values():
+        assert numpy.max(numpy.abs(numpy.diff(numpy.array(robot.alphaPath)[:, 1]))) <= rg.angStep + 1e-9
+
+
+def test_pathViews():
+    # path attributes are read only numpy views, no copies
+    xPos, yPos = utils.hexFromDia(7, pitch=22.4)
+    rg = RobotGrid(1, 2.5, seed=0)
+    for robotID, (x, y) in enumerate(zip(xPos, yPos)):
+        rg.addRobot(robotID, str(robotID), [x, y, 0], hasApogee)
+        rg.robotDict[robotID].setDestinationAlphaBeta(0, 180)
+    rg.initGrid()
+    for rID in rg.robotDict:
+        rg.getRobot(rID).setXYUniform()
+    rg.decollideGrid()
+    rg.pathGenGreedy()
+    robot = rg.robotDict[0]
+    view = robot.alphaPath
+    assert isinstance(view, numpy.ndarray)
+    assert view.shape == (rg.nSteps, 2)
+    assert not view.flags.writeable
+    assert not view.flags.owndata
+    assert numpy.shares_memory(view, robot.alphaPath)
+    with pytest.raises(ValueError):
+        view[0, 1] = 0
+    assert robot.simplifiedAlphaPath.shape == (0, 2)
+    robot.simplifiedAlphaPath = [[0, 1], [2, 3]]
+    assert robot.simplifiedAlphaPath.tolist() == [[0, 1], [2, 3]]
+
+
 def test_withDefulatArgs(plot=False):
     rg = RobotGridAPO() # this is the test, that no args still works
 
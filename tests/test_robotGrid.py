@@ -1,4 +1,6 @@
 import pytest
+import numpy
+import pickle
 
 import kaiju
 from kaiju.robotGrid import RobotGridAPO
@@ -48,3 +50,92 @@ def test_target_array():
         assert rg2.targetDict[id].priority == rg.targetDict[id].priority
         assert rg2.targetDict[id].fiberType == rg.targetDict[id].fiberType
         assert rg2.targetDict[id].id == rg.targetDict[id].id
+
+
+def test_batchKinematics():
+    # one call for the whole grid matches robot by robot kinematics
+    rg = RobotGridAPO()
+    robotIDs = numpy.array(list(rg.robotDict.keys()), dtype=numpy.int32)
+    nRobots = len(robotIDs)
+    alphas = numpy.random.random_sample(nRobots)*360
+    betas = numpy.random.random_sample(nRobots)*180
+    met, ap, boss, segStart, segEnd = rg.forwardKinematics(robotIDs, alphas, betas)
+    assert met.shape == (nRobots, 3)
+    for ii, robotID in enumerate(robotIDs):
+        robot = rg.robotDict[robotID]
+        robot.setAlphaBeta(alphas[ii], betas[ii])
+        assert numpy.allclose(met[ii], robot.metWokXYZ)
+        assert numpy.allclose(ap[ii], robot.apWokXYZ)
+        assert numpy.allclose(boss[ii], robot.bossWokXYZ)
+        assert numpy.allclose(segStart[ii], robot.collisionSegWokXYZ[0])
+        assert numpy.allclose(segEnd[ii], robot.collisionSegWokXYZ[1])
+
+    fiberTypes = numpy.full(nRobots, int(kaiju.cKaiju.BossFiber), dtype=numpy.int32)
+    alphaBetas = rg.inverseKinematics(robotIDs, boss, fiberTypes)
+    assert alphaBetas.shape == (nRobots, 2)
+    roundTrip = rg.forwardKinematics(robotIDs, alphaBetas[:, 0], alphaBetas[:, 1])[2]
+    assert numpy.allclose(roundTrip, boss)
+    # out of reach
+    farAway = boss + 100
+    assert numpy.all(numpy.isnan(rg.inverseKinematics(robotIDs, farAway, fiberTypes)))
+
+
+def test_liveDicts():
+    # dicts are views onto the grid's maps, not copies
+    rg = RobotGridAPO()
+    robotDict = rg.robotDict
+    targetDict = rg.targetDict
+    assert isinstance(robotDict, kaiju.cKaiju.RobotDict)
+    robotID = next(iter(robotDict))
+    assert robotID in robotDict
+    assert robotDict[robotID] is rg.getRobot(robotID)
+    assert len(robotDict.keys()) == len(list(robotDict.values())) == rg.nRobots
+    with pytest.raises(KeyError):
+        robotDict[-1]
+    assert len(targetDict) == 0
+    robot = robotDict[robotID]
+    rg.addTarget(5, robot.bossWokXYZ, kaiju.cKaiju.BossFiber)
+    assert len(targetDict) == 1
+    assert targetDict[5].id == 5
+    # changes go through the grid, which keeps its indexes in step
+    with pytest.raises(TypeError):
+        del rg.targetDict[5]
+    with pytest.raises(TypeError):
+        rg.targetDict[6] = targetDict[5]
+    with pytest.raises(TypeError):
+        del rg.robotDict[robotID]
+    assert len(targetDict) == 1
+    assert 5 in robot.validTargetIDs
+    assert robotID in robotDict
+
+
+def test_snapshot(tmp_path):
+    # snapshots and pickles round trip the whole grid, paths included
+    rg = RobotGridAPO()
+    for robot in rg.robotDict.values():
+        robot.setXYUniform()
+        robot.setDestinationAlphaBeta(0, 180)
+        rg.addTarget(robot.id, robot.bossWokXYZ, kaiju.cKaiju.BossFiber)
+    rg.optimizeTargets()
+    assert len(rg.assignedTargets()) > 0
+    rg.pathGenGreedy()
+    rg.runtime = 5
+    snapshot = rg.snapshot()
+    filename = str(tmp_path / "grid.snap")
+    rg.saveSnapshot(filename)
+    loaded = RobotGridAPO(stepSize=2)
+    loaded.loadSnapshot(filename)
+    pickled = pickle.loads(pickle.dumps(rg))
+    assert type(pickled) is type(rg)
+    assert pickled.runtime == 5
+    for copy in [loaded, pickled]:
+        assert copy.snapshot() == snapshot
+        assert copy.angStep == rg.angStep
+        assert copy.getNCollisions() == rg.getNCollisions()
+        assert copy.assignedTargets() == rg.assignedTargets()
+        for robotID, robot in rg.robotDict.items():
+            assert numpy.array_equal(copy.robotDict[robotID].alphaPath, robot.alphaPath)
+            assert copy.robotDict[robotID].robotNeighbors == robot.robotNeighbors
+    with pytest.raises(RuntimeError):
+        loaded.restore(snapshot[:len(snapshot)//2])
+    assert loaded.snapshot() == snapshot
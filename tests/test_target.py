@@ -1,6 +1,7 @@
 import pytest
 
 import numpy
+import time
 import matplotlib.pyplot as plt
 
 from kaiju.cKaiju import BossFiber, ApogeeFiber, MetrologyFiber
@@ -21,6 +22,9 @@ def test_nonInit():
         txyz = [0,10,fpZ]
         rg.addTarget(targetID=1, xyzWok=txyz, fiberType=BossFiber, priority=1)
     assert "Initialize RobotGrid before adding targets" in str(excinfo.value)
+    with pytest.raises(RuntimeError) as excinfo:
+        rg.updateTargets([], numpy.array([1]), numpy.array([txyz]), numpy.array([int(BossFiber)], dtype=numpy.int32), numpy.array([1.0]))
+    assert "Initialize RobotGrid before adding targets" in str(excinfo.value)
 
 
 def test_doubleTargetID():
@@ -120,6 +124,45 @@ def test_validRobots(plot=False):
         ax.set_aspect("equal")
         plt.savefig("subsetTarg.png", dpi=250)
 
+def test_reachCandidates():
+    # the reach index finds the same robots as checking every robot
+    nTargs = 2000
+    rg = generateTargs(nTargs, BossFiber)
+    for tid, target in rg.targetDict.items():
+        validRobotIDs = [
+            rid for rid in rg.robotDict if rg.isValidAssignment(rid, tid)
+        ]
+        assert target.validRobotIDs == validRobotIDs
+        assert set(validRobotIDs) <= set(rg.reachCandidates(target.xyzWok))
+
+
+def test_addTargets():
+    # bulk ingestion matches adding targets one at a time
+    nTargs = 5000
+    xyzWok = numpy.zeros((nTargs, 3))
+    xyzWok[:, 0] = numpy.random.random_sample(nTargs)*650 - 325
+    xyzWok[:, 1] = numpy.random.random_sample(nTargs)*560 - 280
+    xyzWok[:, 2] = fpZ
+    targetIDs = numpy.arange(nTargs) + 10
+    fiberTypes = numpy.arange(nTargs, dtype=numpy.int32) % 2 + 1
+    priorities = numpy.arange(nTargs) % 3 + 0.
+    fiberTypeList = [ApogeeFiber, BossFiber]
+    rgSingle = RobotGridAPO()
+    for tid, xyz, ft, pri in zip(targetIDs, xyzWok, fiberTypes, priorities):
+        rgSingle.addTarget(tid, xyz, fiberTypeList[ft - 1], pri)
+    rgBulk = RobotGridAPO()
+    rgBulk.addTargets(targetIDs, xyzWok, fiberTypes, priorities)
+    assert len(rgBulk.targetDict) == nTargs
+    for tid, target in rgSingle.targetDict.items():
+        assert rgBulk.targetDict[tid].validRobotIDs == target.validRobotIDs
+        assert rgBulk.targetDict[tid].fiberType == target.fiberType
+    for rid, robot in rgSingle.robotDict.items():
+        assert rgBulk.robotDict[rid].validTargetIDs == robot.validTargetIDs
+    with pytest.raises(RuntimeError) as excinfo:
+        rgBulk.addTargets(targetIDs[:2], xyzWok[:2], fiberTypes[:2], priorities[:2])
+    assert "Target ID already exists" in str(excinfo.value)
+
+
 def test_targetAssign(plot=False):
     # rg = utils.robotGridFromFilledHex()
     rg = RobotGridAPO()
@@ -159,6 +202,170 @@ def test_targetAssign(plot=False):
     if plot:
         utils.plotOne(0, rg, figname="afterAssign.png", isSequence=False)
 
+def test_wouldCollideWithAssigned():
+    # what-if queries match really assigning, and leave the grid alone
+    rg = RobotGridAPO()
+    for robot in rg.robotDict.values():
+        robot.setXYUniform()
+    rg.decollideGrid()
+    for rID, robot in rg.robotDict.items():
+        rg.addTarget(rID, robot.bossWokXYZ, BossFiber)
+        if rID % 2 == 0:
+            rg.assignRobot2Target(rID, rID)
+    for rID, robot in rg.robotDict.items():
+        alpha, beta = robot.alpha, robot.beta
+        for tID in robot.validTargetIDs:
+            result = rg.wouldCollideWithAssigned(rID, tID)
+            assert (robot.alpha, robot.beta) == (alpha, beta)
+            target = rg.targetDict[tID]
+            ab = robot.alphaBetaFromWokXYZ(target.xyzWok, target.fiberType)
+            colliders = rg.robotCollidersAt(rID, ab[0], ab[1])
+            assert set(result[2]) <= set(colliders)
+            assert result[1] == (len(rg.fiducialCollidersAt(rID, ab[0], ab[1])) > 0)
+            assert rg.canReach(rID, target.xyzWok, target.fiberType)
+        assert robot.isAssigned() == (rID % 2 == 0)
+        assert rg.robotColliders(rID) == rg.robotCollidersAt(rID, alpha, beta)
+
+
+def test_conflictGraph():
+    # edges match wouldCollideWithAssigned and shared targets
+    nTargs = 3000
+    rg = generateTargs(nTargs, BossFiber)
+    rg.buildConflictGraph()
+    # read only views onto the graph, not copies
+    nodeRobotIDs = rg.nodeRobotIDs
+    nodeTargetIDs = rg.nodeTargetIDs
+    assert isinstance(nodeRobotIDs, numpy.ndarray)
+    assert not nodeRobotIDs.flags.writeable
+    assert not nodeRobotIDs.flags.owndata
+    nNodes = len(nodeRobotIDs)
+    assert nNodes == sum(len(r.validTargetIDs) for r in rg.robotDict.values())
+    assert len(rg.conflictStart) == nNodes + 1
+    assert rg.conflictStart[-1] == len(rg.conflictNodes)
+    rng = numpy.random.default_rng(0)
+    nChecked = 0
+    for node in rng.integers(0, nNodes, 300):
+        node = int(node)
+        robotID = int(nodeRobotIDs[node])
+        targID = int(nodeTargetIDs[node])
+        assert rg.conflictNode(robotID, targID) == node
+        for otherID in rg.robotDict[robotID].robotNeighbors:
+            for otherTargID in rg.robotDict[otherID].validTargetIDs:
+                otherNode = rg.conflictNode(otherID, otherTargID)
+                assert rg.nodesConflict(node, otherNode) == rg.nodesConflict(otherNode, node)
+                if otherTargID == targID:
+                    assert rg.nodesConflict(node, otherNode)
+                    continue
+                rg.assignRobot2Target(otherID, otherTargID)
+                colliders = rg.wouldCollideWithAssigned(robotID, targID)[2]
+                assert rg.nodesConflict(node, otherNode) == (otherID in colliders)
+                rg.unassignRobot(otherID)
+                nChecked += 1
+    assert nChecked > 0
+
+    # edges depend on the collision distance
+    rg.setCollisionBuffer(rg.collisionBuffer + 0.5)
+    with pytest.raises(RuntimeError) as excinfo:
+        rg.greedyAssign()
+    assert "Conflict graph is stale" in str(excinfo.value)
+
+
+def test_optimizeTargets():
+    # assigned robots are on valid targets and never collide there,
+    # unassigned ones are moved out of their way
+    nTargs = 5000
+    rg = RobotGridAPO()
+    xyzWok = numpy.zeros((nTargs, 3))
+    xyzWok[:, 0] = numpy.random.random_sample(nTargs)*650 - 325
+    xyzWok[:, 1] = numpy.random.random_sample(nTargs)*560 - 280
+    xyzWok[:, 2] = fpZ
+    priorities = numpy.random.randint(1, 6, nTargs) + 0.
+    fiberTypes = numpy.full(nTargs, int(BossFiber), dtype=numpy.int32)
+    rg.addTargets(numpy.arange(nTargs), xyzWok, fiberTypes, priorities)
+
+    tstart = time.time()
+    total = rg.optimizeTargets()
+    print("optimizeTargets took", time.time() - tstart)
+    assert rg.getNCollisions() == 0
+    assigned = [r for r in rg.robotDict.values() if r.isAssigned()]
+    assert len(assigned) > 0.9*len(rg.robotDict)
+    assert total == sum(rg.targetDict[r.assignedTargetID].priority for r in assigned)
+    for robot in assigned:
+        target = rg.targetDict[robot.assignedTargetID]
+        assert target.assignedRobotID == robot.id
+        assert robot.id in target.validRobotIDs
+        collided, fiducialCollided, colliders = rg.isCollidedWithAssigned(robot.id)
+        assert not collided
+
+    # local search never makes things worse
+    rg.greedyAssign(usePriority=False)
+    nGreedy = len(rg.assignedTargets())
+    assert rg.pairwiseSwap(usePriority=False) >= 0
+    assert len(rg.assignedTargets()) >= nGreedy
+
+
+def test_updateTargets():
+    # a field diff gives the same reachability as rebuilding, and keeps
+    # assignments to targets in both fields
+    nTargs = 4000
+    xyzWok = numpy.zeros((nTargs, 3))
+    xyzWok[:, 0] = numpy.random.random_sample(nTargs)*650 - 325
+    xyzWok[:, 1] = numpy.random.random_sample(nTargs)*560 - 280
+    xyzWok[:, 2] = fpZ
+    targetIDs = numpy.arange(nTargs)
+    fiberTypes = numpy.full(nTargs, int(BossFiber), dtype=numpy.int32)
+    priorities = numpy.ones(nTargs)
+    first, second = slice(0, 3000), slice(1000, 4000)
+
+    rg = RobotGridAPO()
+    rg.addTargets(targetIDs[first], xyzWok[first], fiberTypes[first], priorities[first])
+    rg.optimizeTargets()
+    keptAssignments = {
+        r.id: r.assignedTargetID for r in rg.robotDict.values()
+        if r.isAssigned() and r.assignedTargetID >= 1000
+    }
+    rg.updateTargets(
+        list(range(1000)), targetIDs[3000:], xyzWok[3000:],
+        fiberTypes[3000:], priorities[3000:]
+    )
+    for robotID, targetID in keptAssignments.items():
+        assert rg.robotDict[robotID].assignedTargetID == targetID
+    for robot in rg.robotDict.values():
+        if robot.isAssigned():
+            assert robot.assignedTargetID >= 1000
+
+    rgFresh = RobotGridAPO()
+    rgFresh.addTargets(targetIDs[second], xyzWok[second], fiberTypes[second], priorities[second])
+    assert sorted(rg.targetDict.keys()) == sorted(rgFresh.targetDict.keys())
+    for tid, target in rgFresh.targetDict.items():
+        assert rg.targetDict[tid].validRobotIDs == target.validRobotIDs
+    for rid, robot in rgFresh.robotDict.items():
+        assert sorted(rg.robotDict[rid].validTargetIDs) == sorted(robot.validTargetIDs)
+
+    with pytest.raises(RuntimeError) as excinfo:
+        rg.removeTargets([0])
+    assert "Target ID does not exist" in str(excinfo.value)
+    with pytest.raises(RuntimeError) as excinfo:
+        rg.pairwiseSwap()
+    assert "Conflict graph is stale" in str(excinfo.value)
+
+    # a rejected update leaves the field alone
+    keys = sorted(rg.targetDict.keys())
+    assigned = {r.id: r.assignedTargetID for r in rg.robotDict.values()}
+    badFiberTypes = fiberTypes[:1000].copy()
+    badFiberTypes[-1] = 7
+    for badUpdate in [
+        (xyzWok[:999], fiberTypes[:1000], priorities[:1000]),
+        (xyzWok[:1000], fiberTypes[:999], priorities[:1000]),
+        (xyzWok[:1000], fiberTypes[:1000], priorities[:999]),
+        (xyzWok[:1000], badFiberTypes, priorities[:1000]),
+    ]:
+        with pytest.raises(RuntimeError):
+            rg.updateTargets(list(range(1000, 2000)), targetIDs[:1000], *badUpdate)
+        assert sorted(rg.targetDict.keys()) == keys
+        assert {r.id: r.assignedTargetID for r in rg.robotDict.values()} == assigned
+
+
 """
 robot alpha beta (138.53, 1.66) xpos/ypos (-33.6 -252.1866) number: 205 valid targs []
 alphabeta [138.5303302264647, 1.6620349800302785] boss fiber not in valid list?